@@ -9,6 +9,10 @@
  
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
+#include "KeySorter.h"
+#include "IoBatch.h"
+#include <algorithm>
+#include <climits>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
@@ -16,12 +20,29 @@
 #include <fstream>
 using namespace std;
 
+// the format of the nodes. an index written in another format has to be
+// built again by loading its table.
+static const int INDEX_FORMAT_VERSION = 5;
+
+const double BTreeIndex::DEFAULT_FILL_FACTOR = 0.9;
+
+double BTreeIndex::fillFactor = (getenv("BRUINBASE_FILL_FACTOR") != NULL &&
+                                 atof(getenv("BRUINBASE_FILL_FACTOR")) > 0 &&
+                                 atof(getenv("BRUINBASE_FILL_FACTOR")) <= 1) ?
+                                atof(getenv("BRUINBASE_FILL_FACTOR")) : DEFAULT_FILL_FACTOR;
+
+// the nonleaf nodes in memory of every index file opened, by file name
+std::map<std::string, BTreeIndex::NodeCache*> BTreeIndex::caches;
+
 /*
  * BTreeIndex constructor
  */
 BTreeIndex::BTreeIndex()
 {
     rootPid = -1;
+    treeHeight = 0;
+    entryCount = 0;
+    cache = NULL;
 }
 
 /*
@@ -36,12 +57,18 @@ RC BTreeIndex::open(const string& indexname, char mode)
   if(pf.open(indexname, mode))
     return 1;
 
-  char info[PageFile::PAGE_SIZE];
+  // the nodes of the tree are visited in no particular order
+  if (mode == 'r' || mode == 'R')
+    pf.advise(PageFile::RANDOM);
+
+  char info[PageFile::MAX_PAGE_SIZE];
+  memset(info, 0, pf.getPageSize());
   // Settiar el id de la pagina raiz y la altura del arbol
   if (pf.endPid() == 0)
   {
     rootPid = -1;
     treeHeight = 0;
+    entryCount = 0;
     if (pf.write(0, info))
     {
        return 2;
@@ -53,8 +80,46 @@ RC BTreeIndex::open(const string& indexname, char mode)
     {
       return 2;
     }
+    // read the root PageId, the height of the tree, the format version
+    // and the # of entries from the info page. an index of an older
+    // format, or from before the node header with no version, is not opened.
     rootPid = *((PageId *)info);
     treeHeight = *((int *)(info+sizeof(PageId)));
+    if (*((int *)(info+sizeof(PageId)+sizeof(int))) != INDEX_FORMAT_VERSION)
+    {
+      pf.close();
+      return RC_INVALID_FILE_FORMAT;
+    }
+    entryCount = *((int *)(info+sizeof(PageId)+2*sizeof(int)));
+  }
+
+  // copy the nonleaf nodes into memory, unless they were copied by an
+  // earlier open() of the file and the tree has not changed since. an
+  // insert changes the counts of the nonleaf nodes, and the # of entries.
+  NodeCache*& c = caches[indexname];
+  if (c == NULL) c = new NodeCache();
+  cache = c;
+  if (cache->rootPid != rootPid || cache->treeHeight != treeHeight ||
+      cache->endPid != pf.endPid() || cache->entryCount != entryCount || treeHeight <= 1)
+  {
+    cache->inner.clear();
+    cache->innerSlot.clear();
+    cache->rootPid = rootPid;
+    cache->treeHeight = treeHeight;
+    cache->entryCount = entryCount;
+    cache->endPid = -1;
+    if (treeHeight > 1)
+    {
+      RC rc = loadNodes(rootPid);
+      if (rc < 0)
+      {
+        cache->inner.clear();
+        cache->innerSlot.clear();
+        pf.close();
+        return rc;
+      }
+    }
+    cache->endPid = pf.endPid();
   }
 
   return 0;
@@ -66,74 +131,182 @@ RC BTreeIndex::open(const string& indexname, char mode)
  */
 RC BTreeIndex::close()
 {
-    char info[PageFile::PAGE_SIZE];
+    char info[PageFile::MAX_PAGE_SIZE];
+    memset(info, 0, pf.getPageSize());
     *((PageId *)info) = rootPid;
     *((int *)(info+sizeof(PageId))) = treeHeight;
+    *((int *)(info+sizeof(PageId)+sizeof(int))) = INDEX_FORMAT_VERSION;
+    *((int *)(info+sizeof(PageId)+2*sizeof(int))) = entryCount;
     pf.write(0,info);
 
+    // the tree the copies in the cache stand for
+    if (cache != NULL)
+    {
+      cache->rootPid = rootPid;
+      cache->treeHeight = treeHeight;
+      cache->endPid = pf.endPid();
+      cache->entryCount = entryCount;
+    }
+
     return pf.close();
 }
 
-RC BTreeIndex::insert_helper(int key, const RecordId& rid, PageId pid, int height, int& ofKey, PageId& ofPid)
+RC BTreeIndex::cacheNode(PageId pid, BTNonLeafNode& node)
+{
+  std::map<PageId, int>::iterator it = cache->innerSlot.find(pid);
+  int slot;
+
+  if (it != cache->innerSlot.end())
+  {
+    slot = it->second;
+  }
+  else
+  {
+    slot = (int) cache->inner.size();
+    cache->inner.push_back(InnerNode());
+    cache->innerSlot[pid] = slot;
+  }
+
+  InnerNode& copy = cache->inner[slot];
+  int keyCount = node.getKeyCount();
+
+  copy.level = node.getLevel();
+  copy.keyCount = keyCount;
+  // searchKeys() may read 16 keys past the last one
+  copy.keys.assign(keyCount + 16, INT_MAX);
+  copy.children.resize(keyCount + 1);
+  copy.before.resize(keyCount + 1);
+  node.readEntry(-1, copy.children[0]);
+  copy.before[0] = 0;
+  for (int eid = 0; eid < keyCount; eid++)
+  {
+    node.readEntry(eid, copy.keys[eid], copy.children[eid + 1]);
+    copy.before[eid + 1] = copy.before[eid] + node.getCount(eid - 1);
+  }
+
+  // the slots of the children, which are copied before their parent
+  copy.slots.clear();
+  if (copy.level > 1)
+  {
+    copy.slots.resize(keyCount + 1);
+    for (int i = 0; i <= keyCount; i++)
+    {
+      it = cache->innerSlot.find(copy.children[i]);
+      if (it == cache->innerSlot.end()) return RC_INVALID_FILE_FORMAT;
+      copy.slots[i] = it->second;
+    }
+  }
+  return 0;
+}
+
+RC BTreeIndex::loadNodes(PageId pid)
 {
-  ofKey = -1;
+  RC rc;
+  BTNonLeafNode nln(pf.getPageSize());
+
+  if ((rc = nln.read(pid, pf)) < 0) return rc;
+
+  // the children first, so that the node can refer to their copies
+  if (nln.getLevel() > 1)
+  {
+    for (int eid = -1; eid < nln.getKeyCount(); eid++)
+    {
+      PageId child;
+      nln.readEntry(eid, child);
+      if ((rc = loadNodes(child)) < 0) return rc;
+    }
+  }
+  return cacheNode(pid, nln);
+}
+
+RC BTreeIndex::insert_helper(int key, const RecordId& rid, PageId pid, int height, int& count,
+                             int& ofKey, PageId& ofPid, int& ofCount)
+{
+  // ofPid is the new sibling of the node if the node overflows. any key
+  // may move up to the parent, so ofKey cannot tell an overflow.
+  ofPid = -1;
 
   // Caso base, cuando esta en nodo hoja
   if (height == treeHeight)
   {
-    BTLeafNode ln;
-    ln.read(pid, pf);
+    BTLeafNode ln(pf.getPageSize());
+    if (ln.read(pid, pf))
+      return 1;
     if (ln.insert(key, rid))
     {
       // Overflow, se crea un nuevo nodo hoja y se hace split
-      BTLeafNode newNode;
+      BTLeafNode newNode(pf.getPageSize());
       if (ln.insertAndSplit(key, rid, newNode, ofKey))
         return 1;
 
       // Settea el puntero del nuevo nodo
       ofPid = pf.endPid();
+      ofCount = newNode.getKeyCount();
       newNode.setNextNodePtr(ln.getNextNodePtr());
+      newNode.setPrevNodePtr(pid);
       ln.setNextNodePtr(ofPid);
 
       if (newNode.write(ofPid, pf))
         return 1;
+
+      // the leaf behind the new one points back to it
+      if (newNode.getNextNodePtr() > 0)
+      {
+        BTLeafNode next(pf.getPageSize());
+        if (next.read(newNode.getNextNodePtr(), pf))
+          return 1;
+        next.setPrevNodePtr(ofPid);
+        if (next.write(newNode.getNextNodePtr(), pf))
+          return 1;
+      }
     }
+    count = ln.getKeyCount();
     if (ln.write(pid, pf))
       return 1;
   }
   // NonLeaf node
   else
   {
-    BTNonLeafNode nln;
+    BTNonLeafNode nln(pf.getPageSize());
     int eid;
+    int childCount;
     PageId child;
 
-    nln.read(pid, pf);
+    if (nln.read(pid, pf))
+      return 1;
     nln.locate(key, eid);
     nln.readEntry(eid, child);
-    insert_helper(key, rid, child, height+1, ofKey, ofPid);
-    if (ofKey > 0)
+    if (insert_helper(key, rid, child, height+1, childCount, ofKey, ofPid, ofCount))
+      return 1;
+
+    // the child has one more entry, or gave some of them to its sibling,
+    // so the node is written even without an overflow
+    nln.setCount(eid, childCount);
+    if (ofPid > 0)
     {
       // Overflow en nodo hijo, se inserta una nueva tupla en el nodo actual
-      if (nln.insert(ofKey, ofPid))
+      if (nln.insert(ofKey, ofPid, ofCount))
       {
         // Divide los hermanos del nodo
         int midKey;
-        BTNonLeafNode sibling;
+        BTNonLeafNode sibling(pf.getPageSize());
 
-        if (nln.insertAndSplit(ofKey, ofPid, sibling, midKey))
+        if (nln.insertAndSplit(ofKey, ofPid, ofCount, sibling, midKey))
           return 1;
         ofKey = midKey;
         ofPid = pf.endPid();
-        if (sibling.write(ofPid, pf))
+        ofCount = sibling.getTotalCount();
+        if (sibling.write(ofPid, pf) || cacheNode(ofPid, sibling))
           return 1;
       }
       else
       {
-        ofKey = -1;
+        ofPid = -1;
       }
-      nln.write(pid, pf);
     }
+    count = nln.getTotalCount();
+    if (nln.write(pid, pf) || cacheNode(pid, nln))
+      return 1;
   }
   return 0;
 }
@@ -150,33 +323,75 @@ RC BTreeIndex::insert(int key, const RecordId& rid)
 {
   int ofKey;
   PageId ofPid;
+  int count, ofCount;
+
+  // the # of entries, and the counts of the nonleaf nodes, are ints
+  if (entryCount == INT_MAX) return RC_INDEX_FULL;
 
   //Para la primera vez, crear nodo raiz
   if (treeHeight == 0)
   {
-    BTLeafNode ln;
+    BTLeafNode ln(pf.getPageSize());
     ln.insert(key, rid);
     rootPid = pf.endPid();
     treeHeight = 1;
+    entryCount = 1;
     ln.write(rootPid, pf);
     return 0;
   }
 
-  if (insert_helper(key, rid, rootPid, 1, ofKey, ofPid))
+  if (insert_helper(key, rid, rootPid, 1, count, ofKey, ofPid, ofCount))
     return 1;
+  entryCount++;
 
   // Si hay overflow en el padre, se crea un nuevo nodo raiz
-  if (ofKey > 0)
+  if (ofPid > 0)
   {
-    BTNonLeafNode newRoot;
-    newRoot.initializeRoot(rootPid, ofKey, ofPid);
+    BTNonLeafNode newRoot(pf.getPageSize());
+    newRoot.setLevel(treeHeight);
+    newRoot.initializeRoot(rootPid, count, ofKey, ofPid, ofCount);
     rootPid = pf.endPid();
     treeHeight++;
     newRoot.write(rootPid, pf);
+    if (cacheNode(rootPid, newRoot))
+      return 1;
   }
   return 0;
 }
 
+/*
+ * Find the leftmost leaf that may hold searchKey with the nonleaf nodes
+ * in memory, the bound of the keys searched in it, and the # of entries
+ * in the leaves left of it.
+ */
+RC BTreeIndex::findLeaf(int searchKey, PageId& pid, long long& upper, long long& before)
+{
+  pid = rootPid;
+  upper = (long long) INT_MAX + 1;
+  before = 0;
+  if (treeHeight <= 1) return 0;
+
+  std::map<PageId, int>::iterator root = cache->innerSlot.find(rootPid);
+  if (root == cache->innerSlot.end()) return RC_INVALID_FILE_FORMAT;
+
+  // follow the child pointers down to the leaf level in memory. like
+  // locateChildPtr(), take the pointer behind the largest key < searchKey.
+  // the key behind the pointer taken bounds the keys of the subtree.
+  const InnerNode* node = &cache->inner[root->second];
+  for (;;)
+  {
+    int eid = searchKeys(&node->keys[0], node->keyCount, searchKey);
+    if (eid < node->keyCount) upper = node->keys[eid];
+    before += node->before[eid];
+    if (node->level == 1)
+    {
+      pid = node->children[eid];
+      return 0;
+    }
+    node = &cache->inner[node->slots[eid]];
+  }
+}
+
 /**
  * Run the standard B+Tree key search algorithm and identify the
  * leaf node where searchKey may exist. If an index entry with
@@ -197,25 +412,185 @@ RC BTreeIndex::insert(int key, const RecordId& rid)
  */
 RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
 {
-  PageId pid = rootPid;
-  int i = 0;
-  while (i < treeHeight-1)
-  {
-    int eid;
-    BTNonLeafNode nln;
+  RC rc;
+  PageId pid;
+  long long upper, before;
 
-    nln.read(pid, pf);
-    nln.locateChildPtr(searchKey, eid);
-    nln.readEntry(eid, pid);
-    i++;
+  // an empty tree. leave the cursor at the end of the tree.
+  if (treeHeight == 0)
+  {
+    cursor.pid = 0;
+    cursor.eid = 0;
+    return RC_NO_SUCH_RECORD;
   }
 
-  BTLeafNode ln;
-  ln.read(pid, pf);
+  if ((rc = findLeaf(searchKey, pid, upper, before)) < 0) return rc;
+
+  BTLeafNode ln(pf.getPageSize());
+  if ((rc = ln.read(pid, pf)) < 0) return rc;
  
   cursor.pid = pid;
-  ln.locate(searchKey, cursor.eid);
+  rc = ln.locate(searchKey, cursor.eid);
+
+  // the search ends in the leftmost leaf that may hold searchKey. when
+  // every key of the leaf is smaller, the key may start the next leaf.
+  if (rc == RC_NO_SUCH_RECORD && cursor.eid == ln.getKeyCount() && ln.getNextNodePtr() > 0)
+  {
+    int      key;
+    RecordId rid;
+
+    cursor.pid = ln.getNextNodePtr();
+    cursor.eid = 0;
+    if ((rc = ln.read(cursor.pid, pf)) < 0) return rc;
+    if (ln.readEntry(0, key, rid) == 0 && key == searchKey) return 0;
+    return RC_NO_SUCH_RECORD;
+  }
+  return rc;
+}
+
+// orders the positions of an array by the keys at the positions
+struct KeyOrder {
+  const int* keys;
+  bool operator()(int a, int b) const { return keys[a] < keys[b]; }
+};
+
+/*
+ * Run locate() for many keys at once.
+ * @param keys[IN] the keys to find, in any order
+ * @param n[IN] the # of keys
+ * @param out[OUT] the cursors, one per key in the order of keys
+ * @return the # of keys found. Otherwise, an error code
+ */
+RC BTreeIndex::locateBatch(const int* keys, int n, IndexCursor* out)
+{
+  RC rc = 0;
+  int found = 0;
+
+  if (n <= 0) return 0;
+
+  // an empty tree. leave every cursor at the end of the tree.
+  if (treeHeight == 0)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      out[i].pid = 0;
+      out[i].eid = 0;
+    }
+    return 0;
+  }
+
+  // the keys in ascending order
+  std::vector<int> order(n);
+  for (int i = 0; i < n; i++) order[i] = i;
+  KeyOrder byKey = { keys };
+  std::stable_sort(order.begin(), order.end(), byKey);
+
+  // find the leaf of every key. a key goes down the tree only when it is
+  // beyond the keys of the leaf of the previous key, and the leaves are
+  // listed once each, in key order.
+  std::vector<PageId> leafOf(n);
+  std::vector<PageId> leaves;
+  long long upper = 0, before;
+  for (int i = 0; i < n; i++)
+  {
+    if (i == 0 || keys[order[i]] > upper)
+    {
+      if ((rc = findLeaf(keys[order[i]], leafOf[i], upper, before)) < 0) return rc;
+    }
+    else
+      leafOf[i] = leafOf[i - 1];
+    if (leaves.empty() || leaves.back() != leafOf[i]) leaves.push_back(leafOf[i]);
+  }
+
+  // read the leaves a batch at a time and search the keys in each leaf.
+  // a key beyond every key of its leaf may start the next leaf, which is
+  // checked at the end.
+  int batch = (int) leaves.size();
+  if (batch > IoBatch::QUEUE_DEPTH) batch = IoBatch::QUEUE_DEPTH;
+  BTLeafNode* nodes = new BTLeafNode[batch];
+  std::vector<int> beyond;
+  int pos = 0;
+  for (unsigned start = 0; start < leaves.size() && rc >= 0; start += batch)
+  {
+    int m = std::min((int) (leaves.size() - start), batch);
+    if ((rc = BTLeafNode::readBatch(&leaves[start], m, nodes, pf)) < 0) break;
+
+    for (int j = 0; j < m; j++)
+    {
+      for (; pos < n && leafOf[pos] == leaves[start + j]; pos++)
+      {
+        IndexCursor& cursor = out[order[pos]];
+        cursor.pid = leafOf[pos];
+        if (nodes[j].locate(keys[order[pos]], cursor.eid) == 0) found++;
+        else if (cursor.eid == nodes[j].getKeyCount() && nodes[j].getNextNodePtr() > 0)
+        {
+          cursor.pid = nodes[j].getNextNodePtr();
+          cursor.eid = 0;
+          beyond.push_back(pos);
+        }
+      }
+    }
+  }
+  delete [] nodes;
+  if (rc < 0) return rc;
+
+  BTLeafNode ln(pf.getPageSize());
+  PageId current = -1;
+  for (unsigned i = 0; i < beyond.size(); i++)
+  {
+    const IndexCursor& cursor = out[order[beyond[i]]];
+    int      key;
+    RecordId rid;
+
+    if (cursor.pid != current)
+    {
+      if ((rc = ln.read(cursor.pid, pf)) < 0) return rc;
+      current = cursor.pid;
+    }
+    if (ln.readEntry(0, key, rid) == 0 && key == keys[order[beyond[i]]]) found++;
+  }
+  return found;
+}
 
+RC BTreeIndex::rank(int searchKey, long long& count)
+{
+  RC rc;
+  PageId pid;
+  long long upper;
+  int eid;
+
+  // the leaves left of the leaf of searchKey hold only smaller keys, and
+  // the leaves right of it only larger or equal ones
+  if ((rc = findLeaf(searchKey, pid, upper, count)) < 0) return rc;
+
+  BTLeafNode ln(pf.getPageSize());
+  if ((rc = ln.read(pid, pf)) < 0) return rc;
+  ln.locate(searchKey, eid);
+  count += eid;
+  return 0;
+}
+
+/*
+ * Count the entries with a key in [lo, hi].
+ * @param lo[IN] the smallest key to count
+ * @param hi[IN] the largest key to count
+ * @param count[OUT] the # of entries with a key in [lo, hi]
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::countRange(int lo, int hi, long long& count)
+{
+  RC rc;
+  long long below, upTo;
+
+  count = 0;
+  if (treeHeight == 0 || lo > hi) return 0;
+
+  // the entries smaller than hi + 1, less the entries smaller than lo
+  if (hi == INT_MAX) upTo = entryCount;
+  else if ((rc = rank(hi + 1, upTo)) < 0) return rc;
+  if ((rc = rank(lo, below)) < 0) return rc;
+
+  count = upTo - below;
   return 0;
 }
 
@@ -229,16 +604,28 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
  */
 RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
 {
+  RC rc;
 
-  BTLeafNode ln;
-  ln.read(cursor.pid, pf);
-  ln.readEntry(cursor.eid, key, rid);
+  // the cursor points to page 0 (the header page) past the last leaf
+  if (cursor.pid == 0) return RC_END_OF_TREE;
 
   //Verifica si hay paginas validas
-  if (cursor.pid <= 0 || cursor.pid >= pf.endPid())
+  if (cursor.pid < 0 || cursor.pid >= pf.endPid())
+    return RC_INVALID_CURSOR;
+
+  BTLeafNode ln(pf.getPageSize());
+  if ((rc = ln.read(cursor.pid, pf)) < 0) return rc;
+
+  // locate() leaves the cursor behind the last entry of a leaf
+  // when all its keys are smaller than the search key
+  while (cursor.eid >= ln.getKeyCount())
   {
-    return 1;
+    cursor.pid = ln.getNextNodePtr();
+    cursor.eid = 0;
+    if (cursor.pid <= 0) return RC_END_OF_TREE;
+    if ((rc = ln.read(cursor.pid, pf)) < 0) return rc;
   }
+  ln.readEntry(cursor.eid, key, rid);
 
   // Incrementa el cursor
   cursor.eid++;
@@ -250,3 +637,335 @@ RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
 
   return 0;
 }
+
+/*
+ * Read the (key, rid) pair in front of the location specified by the
+ * index cursor, and move the cursor back to it.
+ * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+ * @param key[OUT] the key stored in front of the index cursor location.
+ * @param rid[OUT] the RecordId stored in front of the index cursor location.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::readBackward(IndexCursor& cursor, int& key, RecordId& rid)
+{
+  RC rc;
+  BTLeafNode ln(pf.getPageSize());
+
+  // the cursor points to page 0 past the last leaf. go back to the end
+  // of the last leaf.
+  if (cursor.pid == 0)
+  {
+    if (treeHeight == 0) return RC_END_OF_TREE;
+    if ((rc = lastLeaf(cursor.pid)) < 0) return rc;
+    cursor.eid = INT_MAX;
+  }
+
+  if (cursor.pid < 0 || cursor.pid >= pf.endPid())
+    return RC_INVALID_CURSOR;
+
+  if ((rc = ln.read(cursor.pid, pf)) < 0) return rc;
+  if (cursor.eid > ln.getKeyCount()) cursor.eid = ln.getKeyCount();
+
+  // in front of the first entry of a leaf is the last entry of the
+  // previous leaf
+  while (cursor.eid <= 0)
+  {
+    PageId prev = ln.getPrevNodePtr();
+    if (prev <= 0) return RC_END_OF_TREE;
+    if ((rc = ln.read(prev, pf)) < 0) return rc;
+    cursor.pid = prev;
+    cursor.eid = ln.getKeyCount();
+  }
+
+  cursor.eid--;
+  ln.readEntry(cursor.eid, key, rid);
+  return 0;
+}
+
+RC BTreeIndex::lastLeaf(PageId& pid) const
+{
+  pid = rootPid;
+  if (treeHeight <= 1) return 0;
+
+  std::map<PageId, int>::iterator root = cache->innerSlot.find(rootPid);
+  if (root == cache->innerSlot.end()) return RC_INVALID_FILE_FORMAT;
+
+  // follow the last child pointers down to the leaf level in memory
+  const InnerNode* node = &cache->inner[root->second];
+  while (node->level > 1) node = &cache->inner[node->slots.back()];
+  pid = node->children.back();
+  return 0;
+}
+
+RC BTreeIndex::setFillFactor(double fill)
+{
+  if (!(fill > 0 && fill <= 1)) return RC_INVALID_ATTRIBUTE;
+  fillFactor = fill;
+  return 0;
+}
+
+/*
+ * Build the index bottom-up from the (key, RecordId) pairs of a sorter.
+ * @param sorter[IN] the pairs to add. sort() must have been called
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::bulkLoad(KeySorter& sorter)
+{
+  RC        rc;
+  int       key;
+  RecordId  rid;
+  int       pageSize = pf.getPageSize();
+  long long n = sorter.count();
+
+  // the # of entries, and the counts of the nonleaf nodes, are ints
+  if (n > INT_MAX - (long long) entryCount) return RC_INDEX_FULL;
+
+  // an index with entries is extended by inserts in key order
+  if (treeHeight != 0)
+  {
+    while ((rc = sorter.next(key, rid)) == 0)
+    {
+      if ((rc = insert(key, rid)) != 0) return rc;
+    }
+    return (rc == RC_END_OF_TREE) ? 0 : rc;
+  }
+  if (n == 0) return 0;
+
+  // the first key, the PageId and the # of entries of every node of the
+  // last level built
+  vector<int>    firstKeys;
+  vector<PageId> pids;
+  vector<int>    counts;
+
+  // the leaves. the pairs are spread evenly over the fewest leaves that
+  // hold them at the fill factor. the leaves are written one after
+  // another, so the next leaf of each is the page behind it, and the
+  // previous leaf the page before it.
+  BTLeafNode probe(pageSize);
+  long long leafCap = max(1, (int) (probe.getMaxKeyCount() * fillFactor));
+  long long leaves = (n + leafCap - 1) / leafCap;
+  PageId    pid = pf.endPid();
+
+  for (long long l = 0; l < leaves; l++, pid++)
+  {
+    BTLeafNode ln(pageSize);
+    long long size = n / leaves + ((l < n % leaves) ? 1 : 0);
+
+    for (long long i = 0; i < size; i++)
+    {
+      if ((rc = sorter.next(key, rid)) != 0) return rc;
+      if ((rc = ln.append(key, rid)) != 0) return rc;
+      if (i == 0) firstKeys.push_back(key);
+    }
+    ln.setNextNodePtr((l + 1 < leaves) ? pid + 1 : 0);
+    ln.setPrevNodePtr((l > 0) ? pid - 1 : 0);
+    if ((rc = ln.write(pid, pf)) != 0) return rc;
+    pids.push_back(pid);
+    counts.push_back((int) size);
+  }
+  treeHeight = 1;
+  entryCount = (int) n;
+
+  // each level above holds a pointer to every node of the level below,
+  // separated by their first keys, until a single node is left. a node
+  // gets at least 3 children, so no node ends up with a single child.
+  while (pids.size() > 1)
+  {
+    BTNonLeafNode  probe(pageSize);
+    vector<int>    upperKeys;
+    vector<PageId> upperPids;
+    vector<int>    upperCounts;
+    long long m = pids.size();
+    long long childCap = max(3, (int) ((probe.getMaxKeyCount() + 1) * fillFactor));
+    long long nodes = (m + childCap - 1) / childCap;
+    long long c = 0;
+
+    for (long long j = 0; j < nodes; j++)
+    {
+      BTNonLeafNode nln(pageSize);
+      long long size = m / nodes + ((j < m % nodes) ? 1 : 0);
+
+      nln.setLevel(treeHeight);
+      nln.initializeRoot(pids[c], counts[c], firstKeys[c + 1], pids[c + 1], counts[c + 1]);
+      for (long long i = 2; i < size; i++)
+      {
+        if ((rc = nln.append(firstKeys[c + i], pids[c + i], counts[c + i])) != 0) return rc;
+      }
+      pid = pf.endPid();
+      if ((rc = nln.write(pid, pf)) != 0) return rc;
+      if ((rc = cacheNode(pid, nln)) != 0) return rc;
+      upperKeys.push_back(firstKeys[c]);
+      upperPids.push_back(pid);
+      upperCounts.push_back(nln.getTotalCount());
+      c += size;
+    }
+    firstKeys.swap(upperKeys);
+    pids.swap(upperPids);
+    counts.swap(upperCounts);
+    treeHeight++;
+  }
+
+  rootPid = pids[0];
+  return 0;
+}
+
+IndexScan::IndexScan()
+{
+  index = NULL;
+  leaf = NULL;
+  pid = 0;
+  eid = 0;
+  keyCount = 0;
+}
+
+IndexScan::~IndexScan()
+{
+  close();
+}
+
+/*
+ * Start the scan at the entry of a cursor set by BTreeIndex::locate().
+ * @param index[IN] the index to read
+ * @param cursor[IN] the cursor pointing to the first entry to read
+ * @return error code. 0 if no error
+ */
+RC IndexScan::open(const BTreeIndex& index, const IndexCursor& cursor)
+{
+  RC rc;
+
+  close();
+  this->index = &index;
+
+  // the cursor points to page 0 (the header page) past the last leaf.
+  // the last leaf is read only if the scan goes back.
+  if (cursor.pid == 0) return 0;
+  if (cursor.pid < 0 || cursor.pid >= index.pf.endPid()) return RC_INVALID_CURSOR;
+
+  if ((rc = load(cursor.pid)) < 0) return rc;
+  eid = (cursor.eid < keyCount) ? cursor.eid : keyCount;
+  return 0;
+}
+
+/*
+ * Release the leaf held by the scan.
+ */
+void IndexScan::close()
+{
+  delete leaf;
+  leaf = NULL;
+  pid = 0;
+  eid = 0;
+  keyCount = 0;
+}
+
+RC IndexScan::load(PageId pid)
+{
+  RC rc;
+
+  if (leaf == NULL) leaf = new BTLeafNode(index->pf.getPageSize());
+  if ((rc = leaf->read(pid, index->pf)) < 0) {
+    close();
+    return rc;
+  }
+  this->pid = pid;
+  keyCount = leaf->getKeyCount();
+  return 0;
+}
+
+RC IndexScan::advance()
+{
+  RC rc;
+
+  // locate() leaves the cursor behind the last entry of a leaf
+  // when all its keys are smaller than the search key. the scan stays
+  // at the end of the last leaf, so that it can go back from there.
+  while (pid > 0 && eid >= keyCount && leaf->getNextNodePtr() > 0) {
+    if ((rc = load(leaf->getNextNodePtr())) < 0) return rc;
+    eid = 0;
+  }
+  return 0;
+}
+
+/*
+ * Read the (key, rid) pair of the current entry and move to the next.
+ * @param key[OUT] the key of the entry
+ * @param rid[OUT] the RecordId of the entry
+ * @return 0 if an entry was read. RC_END_OF_TREE after the last entry
+ */
+RC IndexScan::next(int& key, RecordId& rid)
+{
+  RC rc;
+
+  if ((rc = advance()) < 0) return rc;
+  if (pid == 0 || eid >= keyCount) return RC_END_OF_TREE;
+
+  leaf->readEntry(eid++, key, rid);
+  return 0;
+}
+
+/*
+ * Read the (key, rid) pair in front of the current entry and move back to it.
+ * @param key[OUT] the key of the entry
+ * @param rid[OUT] the RecordId of the entry
+ * @return 0 if an entry was read. RC_END_OF_TREE before the first entry
+ */
+RC IndexScan::prev(int& key, RecordId& rid)
+{
+  RC rc;
+
+  // past the last leaf, start from the end of the last leaf
+  if (pid == 0) {
+    PageId last;
+    if (index == NULL || index->treeHeight == 0) return RC_END_OF_TREE;
+    if ((rc = index->lastLeaf(last)) < 0 || (rc = load(last)) < 0) return rc;
+    eid = keyCount;
+  }
+
+  while (eid <= 0) {
+    if (leaf->getPrevNodePtr() <= 0) return RC_END_OF_TREE;
+    if ((rc = load(leaf->getPrevNodePtr())) < 0) return rc;
+    eid = keyCount;
+  }
+
+  leaf->readEntry(--eid, key, rid);
+  return 0;
+}
+
+/*
+ * Read up to n entries at once, stopping at the end of the current leaf.
+ * @param keys[OUT] the keys of the entries
+ * @param rids[OUT] the RecordIds of the entries
+ * @param n[IN] the largest # of entries to read
+ * @return the # of entries read. 0 after the last entry.
+ *         Otherwise, an error code
+ */
+RC IndexScan::read(int* keys, RecordId* rids, int n)
+{
+  RC rc;
+  int count = 0;
+
+  if ((rc = advance()) < 0) return rc;
+  for (; pid > 0 && count < n && eid < keyCount; count++, eid++) {
+    leaf->readEntry(eid, keys[count], rids[count]);
+  }
+  return count;
+}
+
+/*
+ * @return the cursor pointing to the next entry to read
+ */
+IndexCursor IndexScan::getCursor() const
+{
+  IndexCursor cursor;
+
+  // past the last entry of a leaf, the next entry starts the next leaf
+  if (pid > 0 && eid >= keyCount) {
+    cursor.pid = leaf->getNextNodePtr();
+    cursor.eid = 0;
+    if (cursor.pid < 0) cursor.pid = 0;
+  } else {
+    cursor.pid = pid;
+    cursor.eid = eid;
+  }
+  return cursor;
+}
@@ -13,6 +13,12 @@
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include <map>
+#include <vector>
+
+class KeySorter;
+class BTLeafNode;
+class BTNonLeafNode;
              
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
@@ -29,7 +35,11 @@ typedef struct {
 
 /**
  * Implements a B-Tree index for bruinbase.
- * 
+ * The nonleaf nodes are copied into memory when the index is opened and
+ * kept up to date by insert(), so locate() goes down the tree without
+ * reading a page and reads only the leaf. The copies are kept for the
+ * lifetime of the process and reused by every later open() of the same
+ * file, as long as the tree has not changed since.
  */
 class BTreeIndex {
  public:
@@ -54,7 +64,8 @@ class BTreeIndex {
    * Insert (key, RecordId) pair to the index.
    * @param key[IN] the key for the value inserted into the index
    * @param rid[IN] the RecordId for the record being inserted into the index
-   * @return error code. 0 if no error
+   * @return error code. 0 if no error. RC_INDEX_FULL if the index holds
+   *         INT_MAX entries
    */
   RC insert(int key, const RecordId& rid);
 
@@ -78,27 +89,233 @@ class BTreeIndex {
    */
   RC locate(int searchKey, IndexCursor& cursor);
 
+  /**
+   * Run locate() for many keys at once. The keys are looked up in key
+   * order, so the keys that fall into the same leaf share one descent
+   * of the tree, and each leaf is read at most once for the whole batch.
+   * The leaves are read with concurrent reads.
+   * @param keys[IN] the keys to find, in any order
+   * @param n[IN] the # of keys
+   * @param out[OUT] the cursors, one per key in the order of keys. each
+   *                 cursor is set as locate() would set it
+   * @return the # of keys found. Otherwise, an error code
+   */
+  RC locateBatch(const int* keys, int n, IndexCursor* out);
+
+  /**
+   * Count the entries with a key in [lo, hi]. Every nonleaf entry holds
+   * the # of entries under its child, so the count takes one descent of
+   * the tree and one leaf read for each end of the range, however many
+   * entries are in the range.
+   * @param lo[IN] the smallest key to count
+   * @param hi[IN] the largest key to count
+   * @param count[OUT] the # of entries with a key in [lo, hi]
+   * @return error code. 0 if no error
+   */
+  RC countRange(int lo, int hi, long long& count);
+
   /**
    * Read the (key, rid) pair at the location specified by the index cursor,
    * and move foward the cursor to the next entry.
+   * The leaf is read again on every call. To read many entries, use an
+   * IndexScan, which reads each leaf once.
    * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
    * @param key[OUT] the key stored at the index cursor location
    * @param rid[OUT] the RecordId stored at the index cursor location
    * @return error code. 0 if no error
    */
   RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
-  
+
+  /**
+   * Read the (key, rid) pair in front of the location specified by the
+   * index cursor, and move the cursor back to it. The leaves are linked
+   * both ways, so the entries can be read from the high end of a range.
+   * readBackward() undoes readForward(), and a cursor past the last leaf
+   * goes back to the last entry of the tree.
+   * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+   * @param key[OUT] the key stored in front of the index cursor location
+   * @param rid[OUT] the RecordId stored in front of the index cursor location
+   * @return error code. 0 if no error. RC_END_OF_TREE in front of the first entry
+   */
+  RC readBackward(IndexCursor& cursor, int& key, RecordId& rid);
+
+  /**
+   * Build the index bottom-up from the (key, RecordId) pairs of a sorter.
+   * The leaves are filled up to the fill factor and written in key order,
+   * and each level above is built from the first keys of the level below,
+   * so every node is written once. If the index already has entries,
+   * the pairs are inserted one by one instead.
+   * @param sorter[IN] the pairs to add. sort() must have been called
+   * @return error code. 0 if no error. RC_INDEX_FULL if the index would
+   *         hold more than INT_MAX entries
+   */
+  RC bulkLoad(KeySorter& sorter);
+
+  /**
+   * Set the fraction of a node filled by bulkLoad(). A smaller fill
+   * factor leaves room for later inserts without splits.
+   * The setting is initialized from the environment variable
+   * BRUINBASE_FILL_FACTOR, and is DEFAULT_FILL_FACTOR otherwise.
+   * @param fill[IN] the fill factor, larger than 0 and at most 1
+   * @return error code. 0 if no error
+   */
+  static RC setFillFactor(double fill);
+
+  /**
+   * @return the fraction of a node filled by bulkLoad()
+   */
+  static double getFillFactor() { return fillFactor; }
+
+  // the fill factor if BRUINBASE_FILL_FACTOR is not set
+  static const double DEFAULT_FILL_FACTOR;
+
  private:
-  
-  RC insert_helper(int key, const RecordId& rid, PageId pid, int height, int& ofKey, PageId& ofPid);
+  static double fillFactor;  /// the fraction of a node filled by bulkLoad()
+
+  /**
+   * A nonleaf node kept in memory
+   */
+  struct InnerNode {
+    int                 level;     /// 1 for the parent of the leaves
+    int                 keyCount;  /// the # of keys
+    std::vector<int>    keys;      /// the keys, padded for searchKeys()
+    std::vector<PageId> children;  /// the keyCount + 1 child pointers.
+                                   /// children[i + 1] is behind keys[i]
+    std::vector<int>    slots;     /// the slot in inner of each child
+                                   /// above level 1
+    std::vector<long long> before; /// the # of leaf entries under the
+                                   /// children before each child
+  };
+
+  /**
+   * The nonleaf nodes of an index file in memory
+   */
+  struct NodeCache {
+    PageId                 rootPid;     /// the tree the copies were made of
+    int                    treeHeight;
+    PageId                 endPid;
+    int                    entryCount;
+    std::vector<InnerNode> inner;       /// the nonleaf nodes
+    std::map<PageId, int>  innerSlot;   /// the slot in inner of each node
+  };
+
+  // copy a nonleaf node into the cache, or refresh its copy. the nonleaf
+  // children of the node must be in the cache already.
+  RC cacheNode(PageId pid, BTNonLeafNode& node);
+
+  // copy the nonleaf nodes of the subtree of pid into the cache
+  RC loadNodes(PageId pid);
+
+  // find the leftmost leaf that may hold searchKey with the nonleaf nodes
+  // in memory. every key in (searchKey, upper] is searched in the same
+  // leaf. upper is larger than INT_MAX if the leaf is the last one.
+  // before is the # of entries in the leaves left of the leaf.
+  RC findLeaf(int searchKey, PageId& pid, long long& upper, long long& before);
+
+  // count the entries with a key smaller than searchKey
+  RC rank(int searchKey, long long& count);
+
+  // find the last leaf with the nonleaf nodes in memory
+  RC lastLeaf(PageId& pid) const;
+
+  static std::map<std::string, NodeCache*> caches;  /// the cache of every file by name
+
+  friend class IndexScan;
+
+  // insert the pair into the subtree of pid. count is the # of entries
+  // left in the subtree, and ofCount the # of entries in its new sibling
+  RC insert_helper(int key, const RecordId& rid, PageId pid, int height, int& count,
+                   int& ofKey, PageId& ofPid, int& ofCount);
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
 
+  NodeCache* cache;    /// the nonleaf nodes of the file in memory
+
   PageId   rootPid;    /// the PageId of the root node
   int      treeHeight; /// the height of the tree
-  /// Note that the content of the above two variables will be gone when
-  /// this class is destructed. Make sure to store the values of the two 
+  int      entryCount; /// the # of entries in the tree
+  /// Note that the content of the above three variables will be gone when
+  /// this class is destructed. Make sure to store the values of the three
   /// variables in disk, so that they can be reconstructed when the index
   /// is opened again later.
 };
 
+/**
+ * Reads the entries of a BTreeIndex in key order, forward or backward,
+ * starting at a cursor. The scan keeps the leaf of the current entry
+ * pinned in the buffer pool and reads the next (or previous) leaf only
+ * when it moves past the last (or first) entry of the leaf, so each leaf
+ * is read once however many of its entries are read.
+ * The index must stay open until the scan is closed.
+ */
+class IndexScan {
+ public:
+  IndexScan();
+  ~IndexScan();
+
+  /**
+   * Start the scan at the entry of a cursor set by BTreeIndex::locate().
+   * @param index[IN] the index to read
+   * @param cursor[IN] the cursor pointing to the first entry to read
+   * @return error code. 0 if no error
+   */
+  RC open(const BTreeIndex& index, const IndexCursor& cursor);
+
+  /**
+   * Release the leaf held by the scan.
+   */
+  void close();
+
+  /**
+   * Read the (key, rid) pair of the current entry and move to the next.
+   * @param key[OUT] the key of the entry
+   * @param rid[OUT] the RecordId of the entry
+   * @return 0 if an entry was read. RC_END_OF_TREE after the last entry
+   */
+  RC next(int& key, RecordId& rid);
+
+  /**
+   * Read the (key, rid) pair of the entry in front of the current entry
+   * and move back to it, so that the entries are read in descending key
+   * order. A scan started past the last leaf goes back from the last entry.
+   * @param key[OUT] the key of the entry
+   * @param rid[OUT] the RecordId of the entry
+   * @return 0 if an entry was read. RC_END_OF_TREE before the first entry
+   */
+  RC prev(int& key, RecordId& rid);
+
+  /**
+   * Read up to n entries at once, stopping at the end of the current leaf.
+   * The next call continues with the next leaf.
+   * @param keys[OUT] the keys of the entries
+   * @param rids[OUT] the RecordIds of the entries
+   * @param n[IN] the largest # of entries to read
+   * @return the # of entries read. 0 after the last entry.
+   *         Otherwise, an error code
+   */
+  RC read(int* keys, RecordId* rids, int n);
+
+  /**
+   * @return the cursor pointing to the next entry to read, which can be
+   *         passed to BTreeIndex::readForward()
+   */
+  IndexCursor getCursor() const;
+
+ private:
+  // move to the next leaf if every entry of the current leaf has been read
+  RC advance();
+
+  // read the leaf pid into the scan
+  RC load(PageId pid);
+
+  // the scan holds a pinned leaf, so it cannot be copied
+  IndexScan(const IndexScan&);
+  IndexScan& operator=(const IndexScan&);
+
+  const BTreeIndex* index;   /// the index being read
+  BTLeafNode*       leaf;    /// the current leaf. NULL if none is read
+  PageId            pid;     /// the PageId of the current leaf. 0 past the last leaf
+  int               eid;     /// the next entry to read in the current leaf
+  int               keyCount; /// the # of entries in the current leaf
+};
+
 #endif /* BTREEINDEX_H */
@@ -1,16 +1,156 @@
 #include "BTreeNode.h"
+#include <climits>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 using namespace std;
 
-struct BTLeafNode::Entry {
-  RecordId rid;
-  int key;
-};
+//
+// the key search inside a node. lowerBound() gives the position of the
+// first key >= key among n sorted keys. the vectorized versions narrow the
+// keys down to a window of SCAN_KEYS with a branch-free binary search and
+// compare the whole window at once, 4 (SSE2) or 8 (AVX2) keys per
+// instruction. the window may reach past the last key into the values
+// behind the keys, which are still in the page, and those lanes are masked.
+// every page holds at least SCAN_KEYS keys, so this never reads past it.
+//
 
+// the # of keys compared at once by the vectorized searches
+static const int SCAN_KEYS = 16;
+
+static int lowerBoundScalar(const int* keys, int n, int key)
+{
+  int low = 0, high = n;
+
+  while (high - low > 2 * SCAN_KEYS) {
+    int mid = (low + high) / 2;
+    if (keys[mid] < key)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  while (low < high && keys[low] < key) low++;
+  return low;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static int lowerBoundSse2(const int* keys, int n, int key)
+{
+  const int* base = keys;
+  int len = n;
+
+  while (len > SCAN_KEYS) {
+    int half = len / 2;
+    base = (base[half - 1] < key) ? base + half : base;
+    len -= half;
+  }
+
+  __m128i k = _mm_set1_epi32(key);
+  unsigned less = 0;
+  for (int i = 0; i < SCAN_KEYS / 4; i++) {
+    __m128i v = _mm_loadu_si128((const __m128i*) (base + 4 * i));
+    less |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, v))) << (4 * i);
+  }
+  less &= (1u << len) - 1;
+  return (base - keys) + __builtin_popcount(less);
+}
+
+__attribute__((target("avx2,popcnt")))
+static int lowerBoundAvx2(const int* keys, int n, int key)
+{
+  const int* base = keys;
+  int len = n;
+
+  while (len > SCAN_KEYS) {
+    int half = len / 2;
+    base = (base[half - 1] < key) ? base + half : base;
+    len -= half;
+  }
+
+  __m256i k = _mm256_set1_epi32(key);
+  __m256i v0 = _mm256_loadu_si256((const __m256i*) base);
+  __m256i v1 = _mm256_loadu_si256((const __m256i*) (base + 8));
+  unsigned less = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v0))) |
+                  (_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, v1))) << 8);
+  less &= (1u << len) - 1;
+  return (base - keys) + __builtin_popcount(less);
+}
+#endif
+
+typedef int (*LowerBound)(const int* keys, int n, int key);
+
+static const char* keySearchName = "scalar";
+
+// pick the fastest search the CPU supports, or the one requested
+// by BRUINBASE_KEY_SEARCH if the CPU supports it
+static LowerBound chooseLowerBound()
+{
+  const char* want = getenv("BRUINBASE_KEY_SEARCH");
+  bool any = (want == NULL);
+
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if ((any || strcmp(want, "avx2") == 0) && __builtin_cpu_supports("avx2") &&
+      __builtin_cpu_supports("popcnt")) {
+    keySearchName = "avx2";
+    return lowerBoundAvx2;
+  }
+  if ((any || strcmp(want, "sse2") == 0) && __builtin_cpu_supports("sse2")) {
+    keySearchName = "sse2";
+    return lowerBoundSse2;
+  }
+#endif
+  keySearchName = "scalar";
+  return lowerBoundScalar;
+}
+
+static LowerBound lowerBound = chooseLowerBound();
+
+const char* getKeySearchName()
+{
+  return keySearchName;
+}
+
+int searchKeys(const int* keys, int n, int key)
+{
+  return lowerBound(keys, n, key);
+}
+
+// the position of the first key > key among n sorted keys
+static int upperBound(const int* keys, int n, int key)
+{
+  return (key == INT_MAX) ? n : lowerBound(keys, n, key + 1);
+}
+
+BTLeafNode::BTLeafNode(int pageSize)
+{
+  this->pageSize = pageSize;
+  memset(page, 0, pageSize);
+  buffer = page;
+  pinnedFile = NULL;
+  pinnedPid = -1;
+  header()->flags = BTNodeHeader::LEAF;
+}
+
+BTLeafNode::~BTLeafNode()
+{
+  unpinPage();
+}
+
+void BTLeafNode::unpinPage()
+{
+  if (pinnedFile != NULL) pinnedFile->unpin(pinnedPid);
+  buffer = page;
+  pinnedFile = NULL;
+  pinnedPid = -1;
+}
 
 /*
  * Read the content of the node from the page pid in the PageFile pf.
@@ -20,9 +160,59 @@ struct BTLeafNode::Entry {
  */
 RC BTLeafNode::read(PageId pid, const PageFile& pf)
 {
-  return pf.read(pid, buffer);
+  RC    rc;
+  char* frame;
+
+  // pin the new page before releasing the old one, which may be the same
+  if ((rc = pf.pin(pid, frame)) < 0) return rc;
+  unpinPage();
+
+  pageSize = pf.getPageSize();
+  buffer = frame;
+  pinnedFile = &pf;
+  pinnedPid = pid;
+
+  // the page must hold a leaf node
+  if (!isValid()) {
+    unpinPage();
+    return RC_INVALID_FILE_FORMAT;
+  }
+  return 0;
 }
-    
+
+bool BTLeafNode::isValid()
+{
+  return (header()->flags & BTNodeHeader::LEAF) && header()->keyCount >= 0 &&
+         header()->keyCount <= getMaxKeyCount();
+}
+
+/*
+ * Read the nodes of many pages at once with PageFile::readBatch().
+ * @param pids[IN] the PageIds to read
+ * @param n[IN] the # of pages to read
+ * @param nodes[OUT] the nodes, one per page
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::readBatch(const PageId* pids, int n, BTLeafNode* nodes, const PageFile& pf)
+{
+  RC rc;
+  std::vector<void*> buffers(n);
+
+  if (n <= 0) return 0;
+  for (int i = 0; i < n; i++) {
+    nodes[i].unpinPage();
+    nodes[i].pageSize = pf.getPageSize();
+    buffers[i] = nodes[i].page;
+  }
+  if ((rc = pf.readBatch(pids, n, &buffers[0])) < 0) return rc;
+
+  for (int i = 0; i < n; i++) {
+    if (!nodes[i].isValid()) return RC_INVALID_FILE_FORMAT;
+  }
+  return 0;
+}
+
 /*
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
@@ -31,12 +221,14 @@ RC BTLeafNode::read(PageId pid, const PageFile& pf)
  */
 RC BTLeafNode::write(PageId pid, PageFile& pf)
 {
+  if (pf.getPageSize() != pageSize) return RC_INVALID_FILE_FORMAT;
   return pf.write(pid,buffer);
 }
 
 int BTLeafNode::getMaxKeyCount()
 {
-  return (PageFile::PAGE_SIZE-sizeof(PageId))/(sizeof(Entry));
+  // the next and the previous leaf take the last two PageIds of the page
+  return (pageSize-sizeof(BTNodeHeader)-2*sizeof(PageId))/(sizeof(int)+sizeof(RecordId));
 }
 
 /*
@@ -45,15 +237,7 @@ int BTLeafNode::getMaxKeyCount()
  */
 int BTLeafNode::getKeyCount()
 {
-  int count = 0;
-  Entry* entry = (Entry *) buffer;
-  while(count < getMaxKeyCount()) {
-    if (entry->key == 0)
-      break;
-    count++;
-    entry++;
-  }
-  return count;
+  return header()->keyCount;
 }
 
 /*
@@ -65,24 +249,45 @@ int BTLeafNode::getKeyCount()
 RC BTLeafNode::insert(int key, const RecordId& rid)
 {
   int insertId;
+  int keyCount = getKeyCount();
+  int* k = keys();
+  RecordId* r = rids();
 
-  if (getKeyCount() >= getMaxKeyCount())
+  if (keyCount >= getMaxKeyCount())
     return 1;  //Nodo lleno
-  if (locate (key, insertId))
-    insertId = getKeyCount();  //Agregar al final del nodo
+  // locate() gives the position of the first key >= key,
+  // which is the end of the node if key is the largest
+  locate(key, insertId);
 
-  Entry* insertEntry = (Entry *)buffer + insertId;
-  Entry* curEntry = (Entry *)buffer + getKeyCount();
   // Mover los Entry a la derecha para poder insertar uno nuevo
-  while (curEntry != insertEntry) {
-    Entry* nextEntry = curEntry - 1;
-    *curEntry = *nextEntry;
-    curEntry = nextEntry;
-  }
+  memmove(k + insertId + 1, k + insertId, (keyCount - insertId) * sizeof(int));
+  memmove(r + insertId + 1, r + insertId, (keyCount - insertId) * sizeof(RecordId));
 
   // Insertar nueva tupla en el nodo
-  insertEntry->key = key;
-  insertEntry->rid = rid;
+  k[insertId] = key;
+  r[insertId] = rid;
+  header()->keyCount = keyCount + 1;
+  return 0;
+}
+
+/*
+ * Append the (key, rid) pair behind the last entry of the node.
+ * @param key[IN] the key to append
+ * @param rid[IN] the RecordId to append
+ * @return 0 if successful. Return an error code if the node is full.
+ */
+RC BTLeafNode::append(int key, const RecordId& rid)
+{
+  int keyCount = getKeyCount();
+
+  if (keyCount >= getMaxKeyCount())
+    return RC_NODE_FULL;
+  if (keyCount > 0 && keys()[keyCount-1] > key)
+    return RC_INVALID_ATTRIBUTE;
+
+  keys()[keyCount] = key;
+  rids()[keyCount] = rid;
+  header()->keyCount = keyCount + 1;
   return 0;
 }
 
@@ -101,65 +306,54 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling,
   int eid; //indice donde puede caber un nuevo Entry
   int keyCount = getKeyCount();
   int siblingId = (keyCount+1)/2;
+  int moved = keyCount + 1 - siblingId;
+  int* k = keys();
+  RecordId* r = rids();
+  int mergedKeys[PageFile::MAX_PAGE_SIZE / sizeof(int) + 1];
+  RecordId mergedRids[PageFile::MAX_PAGE_SIZE / sizeof(RecordId) + 1];
 
-  Entry swap; //Entry que mantiene otra Entry
-  swap.key = key;
-  swap.rid = rid;
-
-  if (locate(swap.key, eid))
-    return 2;
+  if (sibling.getKeyCount() != 0 || sibling.pageSize != pageSize)
+    return 1;
 
-  //Mueve los nodos dentro de la Pagina hasta que llegue a la posicion correcta para promover
-  while (eid < siblingId) {
-    Entry* cur = (Entry *)buffer + eid;
-    Entry tmp = *cur;
-    *cur = swap;
-    swap = tmp;
-    eid++;
-  }
-  if (eid == siblingId)
-    siblingKey = swap.key;
-  else
-    siblingKey = ((Entry *)buffer+siblingId)->key;
-
-  //Inserta la tupla dentro de pagina
-  sibling.insert(swap.key, swap.rid);
-
-  //Inserta tuplas despues del split
-  eid = siblingId;
-  while (eid < keyCount) {
-    Entry* cur = (Entry *)buffer + eid;
-    sibling.insert(cur->key, cur->rid);
-    cur->key = 0;
-    eid++;
-  }
+  // the keys of the node with the new one in order
+  locate(key, eid);
+  memcpy(mergedKeys, k, eid * sizeof(int));
+  memcpy(mergedRids, r, eid * sizeof(RecordId));
+  mergedKeys[eid] = key;
+  mergedRids[eid] = rid;
+  memcpy(mergedKeys + eid + 1, k + eid, (keyCount - eid) * sizeof(int));
+  memcpy(mergedRids + eid + 1, r + eid, (keyCount - eid) * sizeof(RecordId));
+
+  // the first half stays, the second half moves to the sibling
+  memcpy(k, mergedKeys, siblingId * sizeof(int));
+  memcpy(r, mergedRids, siblingId * sizeof(RecordId));
+  header()->keyCount = siblingId;
+  memcpy(sibling.keys(), mergedKeys + siblingId, moved * sizeof(int));
+  memcpy(sibling.rids(), mergedRids + siblingId, moved * sizeof(RecordId));
+  sibling.header()->keyCount = moved;
+
+  siblingKey = mergedKeys[siblingId];
   return 0;
 }
 
 /*
  * Find the entry whose key value is larger than or equal to searchKey
  * and output the eid (entry number) whose key value >= searchKey.
+ * If all keys are smaller than searchKey, eid is set to the key count.
  * Remember that all keys inside a B+tree node should be kept sorted.
  * @param searchKey[IN] the key to search for
  * @param eid[OUT] the entry number that contains a key larger than or equalt to searchKey
- * @return 0 if successful. Return an error code if there is an error.
+ * @return 0 if searchKey is found. If not, RC_NO_SUCH_RECORD.
  */
 RC BTLeafNode::locate(int searchKey, int& eid)
 {
-  eid = 0;
-  while (eid < getKeyCount()) {
-    Entry* entry = (Entry *)buffer + eid;
-    if (searchKey > entry->key)
-      eid++;
-    else
-      break;
-  }
+  int keyCount = getKeyCount();
+
+  eid = lowerBound(keys(), keyCount, searchKey);
 
   // Asegura que no se haya pasado de la ultima entrada
-  if (eid == getKeyCount()) {
-    eid = -1;
-    return 1;
-  }
+  if (eid == keyCount || keys()[eid] != searchKey)
+    return RC_NO_SUCH_RECORD;
   return 0;
 }
 
@@ -175,40 +369,78 @@ RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
   if (eid < 0 || eid >= getKeyCount())
     return 1;
 
-  Entry* entry = (Entry *)buffer + eid;
-  rid = entry->rid;
-  key = entry->key;
+  rid = rids()[eid];
+  key = keys()[eid];
   return 0;
 }
 
 /*
  * Return the pid of the next sibling node.
- * @return the PageId of the next sibling node 
+ * @return the PageId of the next sibling node
  */
 PageId BTLeafNode::getNextNodePtr()
 {
-  PageId* pid = (PageId *)(buffer+PageFile::PAGE_SIZE) - 1;
+  PageId* pid = (PageId *)(buffer+pageSize) - 1;
   return *pid;
 }
 
 /*
  * Set the pid of the next sibling node.
- * @param pid[IN] the PageId of the next sibling node 
+ * @param pid[IN] the PageId of the next sibling node
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::setNextNodePtr(PageId pid)
 {
-  PageId* ptr = (PageId *)(buffer+PageFile::PAGE_SIZE) - 1;
+  PageId* ptr = (PageId *)(buffer+pageSize) - 1;
   *ptr = pid;
   return 0;
 }
 
+/*
+ * Return the pid of the previous sibling node.
+ * @return the PageId of the previous sibling node
+ */
+PageId BTLeafNode::getPrevNodePtr()
+{
+  PageId* pid = (PageId *)(buffer+pageSize) - 2;
+  return *pid;
+}
+
+/*
+ * Set the pid of the previous sibling node.
+ * @param pid[IN] the PageId of the previous sibling node
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::setPrevNodePtr(PageId pid)
+{
+  PageId* ptr = (PageId *)(buffer+pageSize) - 2;
+  *ptr = pid;
+  return 0;
+}
+
+
+BTNonLeafNode::BTNonLeafNode(int pageSize)
+{
+  this->pageSize = pageSize;
+  memset(page, 0, pageSize);
+  buffer = page;
+  pinnedFile = NULL;
+  pinnedPid = -1;
+  header()->level = 1;
+}
+
+BTNonLeafNode::~BTNonLeafNode()
+{
+  unpinPage();
+}
 
-struct BTNonLeafNode::Entry
+void BTNonLeafNode::unpinPage()
 {
-  int key;
-  PageId pid;
-};
+  if (pinnedFile != NULL) pinnedFile->unpin(pinnedPid);
+  buffer = page;
+  pinnedFile = NULL;
+  pinnedPid = -1;
+}
 
 /*
  * Read the content of the node from the page pid in the PageFile pf.
@@ -218,9 +450,27 @@ struct BTNonLeafNode::Entry
  */
 RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
 {
-  return pf.read(pid, buffer);
+  RC    rc;
+  char* frame;
+
+  // pin the new page before releasing the old one, which may be the same
+  if ((rc = pf.pin(pid, frame)) < 0) return rc;
+  unpinPage();
+
+  pageSize = pf.getPageSize();
+  buffer = frame;
+  pinnedFile = &pf;
+  pinnedPid = pid;
+
+  // the page must hold a nonleaf node
+  if ((header()->flags & BTNodeHeader::LEAF) || header()->level < 1 ||
+      header()->keyCount < 0 || header()->keyCount > getMaxKeyCount()) {
+    unpinPage();
+    return RC_INVALID_FILE_FORMAT;
+  }
+  return 0;
 }
-    
+
 /*
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
@@ -229,6 +479,7 @@ RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
  */
 RC BTNonLeafNode::write(PageId pid, PageFile& pf)
 {
+  if (pf.getPageSize() != pageSize) return RC_INVALID_FILE_FORMAT;
   return pf.write(pid, buffer);
 }
 
@@ -239,46 +490,74 @@ RC BTNonLeafNode::write(PageId pid, PageFile& pf)
  */
 int BTNonLeafNode::getKeyCount()
 {
-  int count = 0;
-  Entry* entry = (Entry *) buffer;
-  while(count < getMaxKeyCount()) {
-    if (entry->key == 0)
-      break;
-    count++;
-    entry++;
-  }
-  return count;
+  return header()->keyCount;
+}
+
+int BTNonLeafNode::getLevel()
+{
+  return header()->level;
+}
+
+void BTNonLeafNode::setLevel(int level)
+{
+  header()->level = level;
 }
 
 /*
  * Insert a (key, pid) pair to the node.
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
+ * @param count[IN] the # of leaf entries under the child pid
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTNonLeafNode::insert(int key, PageId pid)
+RC BTNonLeafNode::insert(int key, PageId pid, int count)
 {
   int insertId;
+  int keyCount = getKeyCount();
+  int* k = keys();
+  PageId* p = pids();
+  int* c = counts();
 
-  if (getKeyCount() >= getMaxKeyCount())
+  if (keyCount >= getMaxKeyCount())
     return 1;  //Nodo esta lleno
-  if (locate (key, insertId))
-    insertId = 0;  //Para insertar al principio
-  else // Para insertar en la siguiente entrada
-    insertId++;
+  // locate() gives the entry of the largest key <= key (-1 if none),
+  // so the new entry goes right behind it
+  locate(key, insertId);
+  insertId++;
 
-  Entry* insertEntry = (Entry *)buffer + insertId;
-  Entry* curEntry = (Entry *)buffer + getKeyCount();
   // Mueve las entradas a la derecha para poder insertar uno nuevo
-  while (curEntry != insertEntry) {
-    Entry* nextEntry = curEntry - 1;
-    *curEntry = *nextEntry;
-    curEntry = nextEntry;
-  }
+  memmove(k + insertId + 1, k + insertId, (keyCount - insertId) * sizeof(int));
+  memmove(p + insertId + 1, p + insertId, (keyCount - insertId) * sizeof(PageId));
+  memmove(c + insertId + 2, c + insertId + 1, (keyCount - insertId) * sizeof(int));
+
+  // Inserta nueva tupla
+  k[insertId] = key;
+  p[insertId] = pid;
+  c[insertId + 1] = count;
+  header()->keyCount = keyCount + 1;
+  return 0;
+}
 
-  // Inserta nueva tupla 
-  insertEntry->key = key;
-  insertEntry->pid = pid;
+/*
+ * Append the (key, pid) pair behind the last entry of the node.
+ * @param key[IN] the key to append
+ * @param pid[IN] the PageId to append
+ * @param count[IN] the # of leaf entries under the child pid
+ * @return 0 if successful. Return an error code if the node is full.
+ */
+RC BTNonLeafNode::append(int key, PageId pid, int count)
+{
+  int keyCount = getKeyCount();
+
+  if (keyCount >= getMaxKeyCount())
+    return RC_NODE_FULL;
+  if (keyCount > 0 && keys()[keyCount-1] > key)
+    return RC_INVALID_ATTRIBUTE;
+
+  keys()[keyCount] = key;
+  pids()[keyCount] = pid;
+  counts()[keyCount + 1] = count;
+  header()->keyCount = keyCount + 1;
   return 0;
 }
 
@@ -288,59 +567,55 @@ RC BTNonLeafNode::insert(int key, PageId pid)
  * The middle key after the split is returned in midKey.
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
+ * @param count[IN] the # of leaf entries under the child pid
  * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
  * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey)
+RC BTNonLeafNode::insertAndSplit(int key, PageId pid, int count, BTNonLeafNode& sibling, int& midKey)
 {
   int eid; //indice donde puede caber un nuevo Entry
   int keyCount = getKeyCount();
   int midId = keyCount/2;
+  int moved = keyCount - midId;
+  int* k = keys();
+  PageId* p = pids();
+  int* c = counts();
+  int mergedKeys[PageFile::MAX_PAGE_SIZE / sizeof(int) + 1];
+  PageId mergedPids[PageFile::MAX_PAGE_SIZE / sizeof(PageId) + 1];
+  int mergedCounts[PageFile::MAX_PAGE_SIZE / sizeof(int) + 2];  // of every child
+
+  if (sibling.getKeyCount() != 0 || sibling.pageSize != pageSize)
+    return 1;
 
-  Entry swap; //Entry que mantiene otra Entry
-  swap.key = key;
-  swap.pid = pid;
-
-  if (locate(swap.key, eid))
-    return 2;
-  eid++;
-
-  //Mover hasta llegar a la posicion correcta para el split
-  while (eid < midId) {
-    Entry* cur = (Entry *)buffer + eid;
-    Entry tmp = *cur;
-    *cur = swap;
-    swap = tmp;
-    eid++;
-  }
-
-  //Settiar el id de la mitad de la hoja
-  if (eid != midId)
-  {
-    Entry *cur = (Entry *)buffer+midId;
-    Entry temp = *cur;
-    midKey = cur->key;
-    *cur = swap;
-    swap = temp;
-  }
-  midKey = swap.key;
-  eid = midId;
-  
-  // Inicializar nodo raiz para convertirlo en hermano
-  Entry* cur = (Entry *)buffer + eid;
-  sibling.initializeRoot(swap.pid,cur->key,cur->pid);
-  cur->key = 0;
+  // the keys of the node with the new one in order
+  locate(key, eid);
   eid++;
-
-  //Inserta tupla despues del split
-  while (eid < keyCount) {
-    cur = (Entry *)buffer + eid;
-
-    sibling.insert(cur->key, cur->pid);
-    cur->key = 0;
-    eid++;
-  }
+  memcpy(mergedKeys, k, eid * sizeof(int));
+  memcpy(mergedPids, p, eid * sizeof(PageId));
+  mergedKeys[eid] = key;
+  mergedPids[eid] = pid;
+  memcpy(mergedKeys + eid + 1, k + eid, (keyCount - eid) * sizeof(int));
+  memcpy(mergedPids + eid + 1, p + eid, (keyCount - eid) * sizeof(PageId));
+  memcpy(mergedCounts, c, (eid + 1) * sizeof(int));
+  mergedCounts[eid + 1] = count;
+  memcpy(mergedCounts + eid + 2, c + eid + 1, (keyCount - eid) * sizeof(int));
+
+  // the keys before the middle one stay. the middle key moves up to the
+  // parent, and its pointer becomes the first pointer of the sibling,
+  // which takes the keys behind it at the same level
+  memcpy(k, mergedKeys, midId * sizeof(int));
+  memcpy(p, mergedPids, midId * sizeof(PageId));
+  memcpy(c, mergedCounts, (midId + 1) * sizeof(int));
+  header()->keyCount = midId;
+  midKey = mergedKeys[midId];
+
+  sibling.setLevel(getLevel());
+  *((PageId *)(sibling.buffer+pageSize) - 1) = mergedPids[midId];
+  memcpy(sibling.keys(), mergedKeys + midId + 1, moved * sizeof(int));
+  memcpy(sibling.pids(), mergedPids + midId + 1, moved * sizeof(PageId));
+  memcpy(sibling.counts(), mergedCounts + midId + 1, (moved + 1) * sizeof(int));
+  sibling.header()->keyCount = moved;
   return 0;
 }
 
@@ -351,38 +626,21 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
  * @param pid[OUT] the pointer to the child node to follow.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid){
-	int count = getKeyCount();
-	int ikey;
-	PageId lpid;
-	PageId rpid;
-	for(int i = 0; i < count; i++){
-		memcpy(&lpid,sizeof(int)+buffer+(i*(sizeof(PageId)+sizeof(int))),sizeof(PageId));
-		memcpy(&ikey,sizeof(int)+buffer+(sizeof(PageId)+i*(sizeof(PageId)+sizeof(int))),sizeof(int));
-		memcpy(&rpid,sizeof(int)+buffer+(sizeof(PageId)+sizeof(int)+i*(sizeof(PageId)+sizeof(int))),sizeof(PageId));
-		if(i == count-1 && searchKey >= ikey){	//looking at last key
-			pid = rpid;
-			return 0;
-		}
-		
-		if(searchKey < ikey){
-			pid = lpid;
-			return 0;
-		}
-	}
-	return -1;
+RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
+{
+  int eid;
+
+  // follow the pointer behind the largest key < searchKey. a key equal
+  // to searchKey may also be at the end of the child before the key.
+  // if there is no such key, readEntry(-1) gives the first pointer.
+  eid = lowerBound(keys(), getKeyCount(), searchKey) - 1;
+  return readEntry(eid, pid);
 }
 
 RC BTNonLeafNode::locate(int searchKey, int& eid)
 {
-  eid = getKeyCount()-1;
-  while (eid >= 0) {
-    Entry* entry = (Entry *)buffer + eid;
-    if (searchKey < entry->key)
-      eid--;
-    else
-      break;
-  }
+  // the entry before the first key > searchKey has the largest key <= searchKey
+  eid = upperBound(keys(), getKeyCount(), searchKey) - 1;
   if (eid == -1)
     return 1;
 
@@ -391,7 +649,26 @@ RC BTNonLeafNode::locate(int searchKey, int& eid)
 
 int BTNonLeafNode::getMaxKeyCount()
 {
-  return (PageFile::PAGE_SIZE-sizeof(PageId))/(sizeof(Entry));
+  // a key, a child PageId and its count per entry, and the first child
+  // PageId and its count
+  return (pageSize-sizeof(BTNodeHeader)-sizeof(PageId)-sizeof(int))/(sizeof(int)+sizeof(PageId)+sizeof(int));
+}
+
+int BTNonLeafNode::getCount(int eid)
+{
+  return counts()[eid + 1];
+}
+
+void BTNonLeafNode::setCount(int eid, int count)
+{
+  counts()[eid + 1] = count;
+}
+
+int BTNonLeafNode::getTotalCount()
+{
+  int total = 0;
+  for (int i = 0; i <= getKeyCount(); i++) total += counts()[i];
+  return total;
 }
 /*
  * Read the (key, pid) pair from the eid entry.
@@ -407,36 +684,58 @@ RC BTNonLeafNode::readEntry(int eid, PageId& pid)
 
   //Retorna el objeto que apunta el pid
   if (eid < 0) {
-    PageId *ptr = (PageId *)(buffer+PageFile::PAGE_SIZE-sizeof(PageId));
+    PageId *ptr = (PageId *)(buffer+pageSize-sizeof(PageId));
     pid = *ptr;
   }
   else {
-    Entry* entry = (Entry *)buffer + eid;
-    pid = entry->pid;
+    pid = pids()[eid];
   }
   return 0;
 }
 
 
+/*
+ * Read the (key, pid) pair from the eid entry.
+ * @param eid[IN] the entry number to read the (key, pid) pair from
+ * @param key[OUT] the key from the entry
+ * @param pid[OUT] the child pointer behind the key
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTNonLeafNode::readEntry(int eid, int& key, PageId& pid)
+{
+  if (eid < 0 || eid >= getKeyCount())
+    return 1;
+
+  key = keys()[eid];
+  pid = pids()[eid];
+  return 0;
+}
+
 /*
  * Initialize the root node with (pid1, key, pid2).
+ * The level of the node is kept.
  * @param pid1[IN] the first PageId to insert
+ * @param count1[IN] the # of leaf entries under pid1
  * @param key[IN] the key that should be inserted between the two PageIds
  * @param pid2[IN] the PageId to insert behind the key
+ * @param count2[IN] the # of leaf entries under pid2
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
+RC BTNonLeafNode::initializeRoot(PageId pid1, int count1, int key, PageId pid2, int count2)
 {
+  short level = header()->level;
+
   //Vaciar el buffer
-  bzero(buffer, PageFile::PAGE_SIZE);
+  bzero(buffer, pageSize);
+  header()->level = level;
   //Un nodo consiste de una llave y un puntero
   //Un puntero apunta a una hoja con claves menores y otra a los claves mayores
-  Entry root;
-  root.key = key;
-  root.pid = pid2;
-
-  *((Entry *) buffer) = root;
-  PageId *ptr1 = (PageId *)(buffer+PageFile::PAGE_SIZE-sizeof(PageId));
+  keys()[0] = key;
+  pids()[0] = pid2;
+  counts()[0] = count1;
+  counts()[1] = count2;
+  header()->keyCount = 1;
+  PageId *ptr1 = (PageId *)(buffer+pageSize-sizeof(PageId));
   *ptr1 = pid1;
   return 0;
-}
\ No newline at end of file
+}
@@ -13,11 +13,60 @@
 #include "RecordFile.h"
 #include "PageFile.h"
 
+/**
+ * A node page starts with a header that holds the # of keys in the node,
+ * the level of the node in the tree (0 for a leaf) and flags. The keys
+ * follow the header in sorted order as an array of their own, and the
+ * RecordIds (leaf) or child PageIds (nonleaf) follow the keys in the same
+ * order, so a search only touches contiguous keys. A nonleaf node also
+ * holds the # of leaf entries under each of its children, behind the
+ * PageIds. Every key value, including 0, can be stored. The last PageId
+ * of the page is the next leaf (leaf) or the first child (nonleaf), and
+ * the PageId before it in a leaf is the previous leaf.
+ */
+struct BTNodeHeader {
+  int   keyCount;  // the # of keys in the node
+  short level;     // the height of the node above the leaves. 0 for a leaf
+  short flags;     // LEAF for a leaf node
+
+  static const short LEAF = 1;
+};
+
+/**
+ * Return the name of the key search used inside the nodes.
+ * The search compares several keys per instruction when the CPU supports
+ * it. BRUINBASE_KEY_SEARCH=avx2|sse2|scalar selects a supported one.
+ * @return "avx2", "sse2" or "scalar"
+ */
+const char* getKeySearchName();
+
+/**
+ * Find the position of the first key >= key among n sorted keys with the
+ * key search of the nodes. The search may read up to 16 ints past the
+ * last key, so the array must be that much longer.
+ * @param keys[IN] the sorted keys
+ * @param n[IN] the # of keys
+ * @param key[IN] the key to search for
+ * @return the position of the first key >= key. n if every key is smaller
+ */
+int searchKeys(const int* keys, int n, int key);
+
 /**
  * BTLeafNode: The class representing a B+tree leaf node.
  */
 class BTLeafNode {
   public:
+   /**
+    * Create an empty node.
+    * @param pageSize[IN] the page size of the file the node is written to
+    */
+    BTLeafNode(int pageSize = PageFile::DEFAULT_PAGE_SIZE);
+
+   /**
+    * Release the page the node was read from, if any.
+    */
+    ~BTLeafNode();
+
    /**
     * Insert the (key, rid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
@@ -27,6 +76,16 @@ class BTLeafNode {
     */
     RC insert(int key, const RecordId& rid);
 
+   /**
+    * Append the (key, rid) pair behind the last entry of the node.
+    * The key must not be smaller than the last key in the node.
+    * It is used to fill the node with pairs in key order.
+    * @param key[IN] the key to append
+    * @param rid[IN] the RecordId to append
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RC append(int key, const RecordId& rid);
+
    /**
     * Insert the (key, rid) pair to the node
     * and split the node half and half with sibling.
@@ -76,6 +135,19 @@ class BTLeafNode {
     */
     RC setNextNodePtr(PageId pid);
 
+   /**
+    * Return the pid of the previous sibling node.
+    * @return the PageId of the previous sibling node. 0 for the first leaf
+    */
+    PageId getPrevNodePtr();
+
+   /**
+    * Set the previous sibling node PageId.
+    * @param pid[IN] the PageId of the previous sibling node
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setPrevNodePtr(PageId pid);
+
    /**
     * Return the number of keys stored in the node.
     * @return the number of keys in the node
@@ -84,30 +156,78 @@ class BTLeafNode {
  
    /**
     * Read the content of the node from the page pid in the PageFile pf.
+    * The node takes the page size of pf.
+    * The node works directly on the page cached in the buffer pool,
+    * which stays pinned until the node is read again or destroyed.
+    * Modifications are made in place and must be written with write().
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC read(PageId pid, const PageFile& pf);
+
+   /**
+    * Read the nodes of many pages at once with PageFile::readBatch().
+    * The pages are copied into the own buffers of the nodes, so unlike
+    * read(), no page stays pinned.
+    * @param pids[IN] the PageIds to read
+    * @param n[IN] the # of pages to read
+    * @param nodes[OUT] the nodes, one per page
+    * @param pf[IN] PageFile to read from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    static RC readBatch(const PageId* pids, int n, BTLeafNode* nodes, const PageFile& pf);
     
    /**
     * Write the content of the node to the page pid in the PageFile pf.
+    * The page size of pf must be the page size of the node.
     * @param pid[IN] the PageId to write to
     * @param pf[IN] PageFile to write to
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC write(PageId pid, PageFile& pf);
 
+   /**
+    * Return the number of keys that fit in the node.
+    * @return the maximum number of keys in the node
+    */
     int getMaxKeyCount();
-    //BTLeafNode();
 
   private:
-    struct Entry;
+    // the header at the beginning of the node page
+    BTNodeHeader* header() { return (BTNodeHeader*) buffer; }
+
+    // true if the header is the header of a valid leaf
+    bool isValid();
+
+    // the keys that follow the header
+    int* keys() { return (int*) (buffer + sizeof(BTNodeHeader)); }
+
+    // the RecordIds that follow the keys
+    RecordId* rids() { return (RecordId*) (keys() + getMaxKeyCount()); }
+
+    // a node may hold a pin on its page, so it cannot be copied
+    BTLeafNode(const BTLeafNode&);
+    BTLeafNode& operator=(const BTLeafNode&);
+
+    // release the pinned page, if any, and go back to the own buffer
+    void unpinPage();
+
+   /**
+    * The content of the node. After read(), this points to the frame that
+    * caches the node page in the buffer pool. Otherwise, it points to page.
+    */
+    char* buffer;
+
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The main memory buffer of a node that was not read from the disk.
     */
-    char buffer[PageFile::PAGE_SIZE];
+    char page[PageFile::MAX_PAGE_SIZE];
+
+    int pageSize;  // the size of the node page. it bounds the key count
+
+    const PageFile* pinnedFile;  // the PageFile of the pinned page
+    PageId          pinnedPid;   // the pinned page. -1 if none
 }; 
 
 
@@ -116,14 +236,37 @@ class BTLeafNode {
  */
 class BTNonLeafNode {
   public:
+   /**
+    * Create an empty node.
+    * @param pageSize[IN] the page size of the file the node is written to
+    */
+    BTNonLeafNode(int pageSize = PageFile::DEFAULT_PAGE_SIZE);
+
+   /**
+    * Release the page the node was read from, if any.
+    */
+    ~BTNonLeafNode();
+
    /**
     * Insert a (key, pid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param count[IN] the # of leaf entries under the child pid
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RC insert(int key, PageId pid, int count);
+
+   /**
+    * Append the (key, pid) pair behind the last entry of the node.
+    * The key must not be smaller than the last key in the node.
+    * It is used to fill the node with pairs in key order.
+    * @param key[IN] the key to append
+    * @param pid[IN] the PageId to append
+    * @param count[IN] the # of leaf entries under the child pid
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, PageId pid);
+    RC append(int key, PageId pid, int count);
 
    /**
     * Insert the (key, pid) pair to the node
@@ -133,15 +276,18 @@ class BTNonLeafNode {
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param count[IN] the # of leaf entries under the child pid
     * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
     * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey);
+    RC insertAndSplit(int key, PageId pid, int count, BTNonLeafNode& sibling, int& midKey);
 
    /**
     * Given the searchKey, find the child-node pointer to follow and
-    * output it in pid.
+    * output it in pid. The pointer behind the largest key smaller than
+    * searchKey is followed, so that the search reaches the leftmost leaf
+    * that may hold searchKey even if copies of the key span several leaves.
     * Remember that the keys inside a B+tree node are sorted.
     * @param searchKey[IN] the searchKey that is being looked up.
     * @param pid[OUT] the pointer to the child node to follow.
@@ -152,11 +298,13 @@ class BTNonLeafNode {
    /**
     * Initialize the root node with (pid1, key, pid2).
     * @param pid1[IN] the first PageId to insert
+    * @param count1[IN] the # of leaf entries under pid1
     * @param key[IN] the key that should be inserted between the two PageIds
     * @param pid2[IN] the PageId to insert behind the key
+    * @param count2[IN] the # of leaf entries under pid2
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC initializeRoot(PageId pid1, int key, PageId pid2);
+    RC initializeRoot(PageId pid1, int count1, int key, PageId pid2, int count2);
 
    /**
     * Return the number of keys stored in the node.
@@ -166,6 +314,10 @@ class BTNonLeafNode {
 
    /**
     * Read the content of the node from the page pid in the PageFile pf.
+    * The node takes the page size of pf.
+    * The node works directly on the page cached in the buffer pool,
+    * which stays pinned until the node is read again or destroyed.
+    * Modifications are made in place and must be written with write().
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
@@ -174,22 +326,113 @@ class BTNonLeafNode {
     
    /**
     * Write the content of the node to the page pid in the PageFile pf.
+    * The page size of pf must be the page size of the node.
     * @param pid[IN] the PageId to write to
     * @param pf[IN] PageFile to write to
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC write(PageId pid, PageFile& pf);
 
+   /**
+    * Read the child pointer behind the eid entry.
+    * @param eid[IN] the entry number. -1 for the first child pointer
+    * @param pid[OUT] the child pointer
+    * @return 0 if successful. Return an error code if there is an error.
+    */
     RC readEntry(int eid, PageId& pid);
+
+   /**
+    * Read the (key, pid) pair from the eid entry.
+    * @param eid[IN] the entry number to read the (key, pid) pair from
+    * @param key[OUT] the key from the entry
+    * @param pid[OUT] the child pointer behind the key
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readEntry(int eid, int& key, PageId& pid);
+
+   /**
+    * Return the # of leaf entries under the child pointer behind the eid entry.
+    * @param eid[IN] the entry number. -1 for the first child pointer
+    * @return the # of leaf entries under the child
+    */
+    int getCount(int eid);
+
+   /**
+    * Set the # of leaf entries under the child pointer behind the eid entry.
+    * @param eid[IN] the entry number. -1 for the first child pointer
+    * @param count[IN] the # of leaf entries under the child
+    */
+    void setCount(int eid, int count);
+
+   /**
+    * Return the # of leaf entries under the node.
+    * @return the sum of the counts of every child
+    */
+    int getTotalCount();
+
+   /**
+    * Find the entry with the largest key that is smaller than or equal
+    * to searchKey.
+    * @param searchKey[IN] the key to search for
+    * @param eid[OUT] the entry number. -1 if every key is larger
+    * @return 0 if there is such an entry. Return an error code if not.
+    */
     RC locate(int searchKey, int& eid);
+
+   /**
+    * Return the number of keys that fit in the node.
+    * @return the maximum number of keys in the node
+    */
     int getMaxKeyCount();
+
+   /**
+    * Return the level of the node, its height above the leaves.
+    * @return the level of the node. 1 for the parent of a leaf
+    */
+    int getLevel();
+
+   /**
+    * Set the level of the node.
+    * @param level[IN] the height of the node above the leaves
+    */
+    void setLevel(int level);
+
   private:
+    // the header at the beginning of the node page
+    BTNodeHeader* header() { return (BTNodeHeader*) buffer; }
+
+    // the keys that follow the header
+    int* keys() { return (int*) (buffer + sizeof(BTNodeHeader)); }
+
+    // the child PageIds that follow the keys. pids()[i] is behind keys()[i]
+    PageId* pids() { return (PageId*) (keys() + getMaxKeyCount()); }
+
+    // the # of leaf entries under each child that follow the PageIds.
+    // counts()[0] is of the first child, counts()[i + 1] of pids()[i]
+    int* counts() { return (int*) (pids() + getMaxKeyCount()); }
+
+    // a node may hold a pin on its page, so it cannot be copied
+    BTNonLeafNode(const BTNonLeafNode&);
+    BTNonLeafNode& operator=(const BTNonLeafNode&);
+
+    // release the pinned page, if any, and go back to the own buffer
+    void unpinPage();
+
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The content of the node. After read(), this points to the frame that
+    * caches the node page in the buffer pool. Otherwise, it points to page.
     */
-    char buffer[PageFile::PAGE_SIZE];
-    struct Entry;
+    char* buffer;
+
+   /**
+    * The main memory buffer of a node that was not read from the disk.
+    */
+    char page[PageFile::MAX_PAGE_SIZE];
+
+    int pageSize;  // the size of the node page. it bounds the key count
+
+    const PageFile* pinnedFile;  // the PageFile of the pinned page
+    PageId          pinnedPid;   // the pinned page. -1 if none
 }; 
 
 #endif /* BTREENODE_H */
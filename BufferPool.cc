@@ -0,0 +1,486 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "BufferPool.h"
+#include <cstdlib>
+#include <strings.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// the maximum # of consecutive dirty pages written by a single pwritev()
+static const int MAX_FLUSH_RUN = 64;
+
+// under 2Q, A1 is evicted first once it holds more than 1/A1_SHARE of the
+// unpinned frames of its size
+static const int A1_SHARE = 4;
+
+BufferPool& BufferPool::getInstance()
+{
+  // the pool is created on first use so that the environment variables
+  // are read only when a page is actually accessed
+  static BufferPool pool(getenv("BRUINBASE_BUFFER_POOL_MB") ?
+                         atoi(getenv("BRUINBASE_BUFFER_POOL_MB")) : DEFAULT_SIZE_MB);
+  return pool;
+}
+
+BufferPool::BufferPool(int megabytes)
+{
+  const char* mode = getenv("BRUINBASE_WRITE_BACK");
+  const char* replacement = getenv("BRUINBASE_REPLACEMENT");
+
+  capacityMB = 0;
+  capacity = used = 0;
+  writeBack = (mode != NULL && atoi(mode) != 0);
+  flushCount = 0;
+  Policy initial = TWO_Q;
+  if (replacement != NULL) parsePolicy(replacement, initial);
+  policy = initial;
+  hitCount = missCount = 0;
+  if (setCapacity(megabytes) < 0) setCapacity(DEFAULT_SIZE_MB);
+}
+
+BufferPool::~BufferPool()
+{
+  // files that are still open at exit keep their dirty pages
+  flushAll();
+  for (int i = 0; i < (int) frames.size(); i++) delete [] frames[i].data;
+}
+
+RC BufferPool::setCapacity(int megabytes)
+{
+  RC rc;
+  std::lock_guard<std::mutex> lock(latch);
+
+  if (megabytes <= 0) return RC_INVALID_ATTRIBUTE;
+
+  // the frames cannot be reallocated while somebody holds a pointer to one
+  for (int i = 0; i < (int) frames.size(); i++) {
+    if (frames[i].pinCount > 0) return RC_BUFFER_POOL_FULL;
+  }
+
+  // the dirty pages have to be saved before the frames are dropped
+  for (int fid = 0; fid < (int) files.size(); fid++) {
+    if ((rc = flush(fid)) < 0) return rc;
+  }
+
+  // drop every frame. the frames are allocated again as pages are read.
+  for (int i = 0; i < (int) frames.size(); i++) delete [] frames[i].data;
+  capacityMB = megabytes;
+  capacity = (size_t) megabytes * 1024 * 1024;
+  used = 0;
+
+  // the frame table never grows beyond the # of the smallest pages that
+  // fit in the pool. reserve it so that frames are never moved.
+  int count = (int) (capacity / PageFile::MIN_PAGE_SIZE);
+  frames.clear();
+  frames.reserve(count);
+  spareFrames.clear();
+  pageTable.clear();
+  pageTable.reserve(count);
+  for (int c = 0; c < SIZE_CLASSES; c++) {
+    classes[c].a1.head = classes[c].a1.tail = -1;
+    classes[c].am.head = classes[c].am.tail = -1;
+    classes[c].a1.length = classes[c].am.length = 0;
+    classes[c].freeFrames.clear();
+  }
+  ghosts.clear();
+  ghostTable.clear();
+
+  return 0;
+}
+
+RC BufferPool::setWriteBack(bool on)
+{
+  RC rc;
+  std::lock_guard<std::mutex> lock(latch);
+
+  // flush under the same latch, so that no page is dirtied in between
+  if (!on) {
+    for (int fid = 0; fid < (int) files.size(); fid++) {
+      if ((rc = flush(fid)) < 0) return rc;
+    }
+  }
+  writeBack = on;
+  return 0;
+}
+
+void BufferPool::setPolicy(Policy policy)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  this->policy = policy;
+}
+
+RC BufferPool::parsePolicy(const char* name, Policy& policy)
+{
+  if (strcasecmp(name, "lru") == 0) policy = LRU;
+  else if (strcasecmp(name, "2q") == 0) policy = TWO_Q;
+  else return RC_INVALID_ATTRIBUTE;
+  return 0;
+}
+
+void BufferPool::resetCounters()
+{
+  std::lock_guard<std::mutex> lock(latch);
+  hitCount = missCount = 0;
+}
+
+int BufferPool::openFile(const struct stat& st, int fd, int pageSize, off_t base,
+                         IoStats* stats)
+{
+  std::lock_guard<std::mutex> lock(latch);
+
+  // a file keeps the id it got when it was opened for the first time
+  for (int fid = 0; fid < (int) files.size(); fid++) {
+    FileInfo& info = files[fid];
+    if (info.dev != st.st_dev || info.ino != st.st_ino) continue;
+
+    // drop the cached pages if somebody else changed the file
+    if (info.size != st.st_size || info.mtime != st.st_mtime ||
+        info.pageSize != pageSize || info.base != base) {
+      invalidateFile(fid);
+    }
+    if (fd >= 0) info.fd = fd;
+    info.pageSize = pageSize;
+    info.base = base;
+    if (stats != NULL) info.stats = stats;
+    return fid;
+  }
+
+  FileInfo info;
+  info.dev = st.st_dev;
+  info.ino = st.st_ino;
+  info.size = st.st_size;
+  info.mtime = st.st_mtime;
+  info.fd = fd;
+  info.pageSize = pageSize;
+  info.base = base;
+  info.stats = stats;
+  files.push_back(info);
+  return (int) files.size() - 1;
+}
+
+void BufferPool::closeFile(int fid, int fd, const struct stat& st)
+{
+  std::lock_guard<std::mutex> lock(latch);
+
+  files[fid].size = st.st_size;
+  files[fid].mtime = st.st_mtime;
+  if (files[fid].fd == fd) files[fid].fd = -1;
+}
+
+RC BufferPool::pin(int fid, PageId pid, char*& frame, bool& valid, bool wait)
+{
+  RC  rc;
+  int i;
+  std::unique_lock<std::mutex> lock(latch);
+
+  // if another thread is reading the page, wait until it is done.
+  // the read may fail, in which case the page is gone from the pool.
+  while ((i = find(fid, pid)) >= 0 && frames[i].loading) {
+    if (!wait) return RC_PAGE_BUSY;
+    loadDone.wait(lock);
+  }
+
+  if (i >= 0) {
+    // the page is cached. take the frame out of the LRU list
+    // when it is pinned for the first time.
+    if (frames[i].pinCount++ == 0) unlink(i);
+
+    frame = frames[i].data;
+    valid = true;
+    hitCount++;
+    return 0;
+  }
+
+  // the page is not cached. assign a frame to it and let the caller
+  // read the page while other threads wait for it.
+  if ((rc = allocate(fid, pid, i)) < 0) return rc;
+  frames[i].pinCount = 1;
+  frames[i].loading = true;
+
+  frame = frames[i].data;
+  valid = false;
+  missCount++;
+  return 0;
+}
+
+void BufferPool::loaded(int fid, PageId pid, bool ok)
+{
+  std::lock_guard<std::mutex> lock(latch);
+
+  int i = find(fid, pid);
+  if (i < 0) return;
+
+  frames[i].loading = false;
+  if (!ok) {
+    // drop the page. the threads waiting for it will find it gone
+    // and read it themselves.
+    frames[i].pinCount = 0;
+    release(i);
+  }
+  loadDone.notify_all();
+}
+
+void BufferPool::unpin(int fid, PageId pid)
+{
+  std::lock_guard<std::mutex> lock(latch);
+
+  int i = find(fid, pid);
+  if (i < 0 || frames[i].pinCount == 0) return;
+
+  // the page becomes evictable again when the last pin is released
+  if (--frames[i].pinCount == 0) linkHead(i);
+}
+
+void BufferPool::markDirty(int fid, PageId pid)
+{
+  std::lock_guard<std::mutex> lock(latch);
+
+  int i = find(fid, pid);
+  if (i < 0 || frames[i].dirty) return;
+
+  frames[i].dirty = true;
+  files[fid].dirty.insert(pid);
+}
+
+RC BufferPool::flushFile(int fid)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  return flush(fid);
+}
+
+RC BufferPool::flushAll()
+{
+  RC rc;
+  std::lock_guard<std::mutex> lock(latch);
+
+  for (int fid = 0; fid < (int) files.size(); fid++) {
+    if ((rc = flush(fid)) < 0) return rc;
+  }
+  return 0;
+}
+
+int BufferPool::find(int fid, PageId pid) const
+{
+  std::unordered_map<PageKey, int>::const_iterator it = pageTable.find(makeKey(fid, pid));
+  return (it == pageTable.end()) ? -1 : it->second;
+}
+
+RC BufferPool::allocate(int fid, PageId pid, int& i)
+{
+  RC rc;
+  int size = files[fid].pageSize;
+  int c = classOf(size);
+  SizeClass& sc = classes[c];
+
+  if (!sc.freeFrames.empty()) {
+    // use an empty frame of the size if there is one
+    i = sc.freeFrames.back();
+    sc.freeFrames.pop_back();
+  } else if (used + size > capacity && (i = victim(sc)) >= 0) {
+    // otherwise, if the pool is full, replace a page of the size.
+    // pinned pages are not in the lists, so they are never evicted.
+    if ((rc = evict(i)) < 0) return rc;
+  } else {
+    // otherwise allocate a new frame, making room for it if necessary
+    if ((rc = reclaim(size, c)) < 0) return rc;
+    if (!spareFrames.empty()) {
+      i = spareFrames.back();
+      spareFrames.pop_back();
+    } else {
+      i = (int) frames.size();
+      frames.push_back(Frame());
+    }
+    frames[i].prev = frames[i].next = -1;
+    frames[i].pinCount = 0;
+    frames[i].dirty = false;
+    frames[i].loading = false;
+    frames[i].size = size;
+    frames[i].data = new char[size];
+    used += size;
+  }
+
+  frames[i].fid = fid;
+  frames[i].pid = pid;
+  pageTable[makeKey(fid, pid)] = i;
+
+  // under 2Q, a page starts in A1 unless it recently left A1
+  std::unordered_map<PageKey, std::list<PageKey>::iterator>::iterator
+    ghost = ghostTable.find(makeKey(fid, pid));
+  frames[i].hot = (policy == LRU || ghost != ghostTable.end());
+  if (ghost != ghostTable.end()) {
+    ghosts.erase(ghost->second);
+    ghostTable.erase(ghost);
+  }
+
+  return 0;
+}
+
+RC BufferPool::reclaim(int size, int keep)
+{
+  RC rc;
+
+  // free the empty frames of other sizes first, and then evict their
+  // least recently used pages
+  for (int c = 0; c < SIZE_CLASSES && used + size > capacity; c++) {
+    if (c == keep) continue;
+    SizeClass& sc = classes[c];
+    while (used + size > capacity && !sc.freeFrames.empty()) {
+      int i = sc.freeFrames.back();
+      sc.freeFrames.pop_back();
+      discard(i);
+    }
+    int i;
+    while (used + size > capacity && (i = victim(sc)) >= 0) {
+      if ((rc = evict(i)) < 0) return rc;
+      discard(i);
+    }
+  }
+
+  return (used + size > capacity) ? RC_BUFFER_POOL_FULL : 0;
+}
+
+int BufferPool::victim(const SizeClass& sc) const
+{
+  // A1 gives up its pages first once it holds more than its share, so
+  // that pages used only once replace each other rather than Am pages
+  if (sc.a1.tail >= 0 &&
+      (sc.am.tail < 0 || sc.a1.length * A1_SHARE > sc.a1.length + sc.am.length)) {
+    return sc.a1.tail;
+  }
+  return sc.am.tail;
+}
+
+RC BufferPool::evict(int i)
+{
+  RC rc;
+  PageKey key = makeKey(frames[i].fid, frames[i].pid);
+
+  // a dirty page has to be written first. flush the whole file
+  // so that its dirty pages go to the disk in page-id order.
+  if (frames[i].dirty && (rc = flush(frames[i].fid)) < 0) return rc;
+  unlink(i);
+  pageTable.erase(key);
+  if (files[frames[i].fid].stats != NULL) files[frames[i].fid].stats->evicted();
+  frames[i].fid = -1;
+
+  // remember a page evicted from A1, so that it goes to Am if it is
+  // read again soon. A1out holds the keys of half as many pages as the
+  // pool has frames.
+  if (!frames[i].hot) {
+    ghosts.push_front(key);
+    ghostTable[key] = ghosts.begin();
+    while (ghosts.size() > frames.size() / 2 + 1) {
+      ghostTable.erase(ghosts.back());
+      ghosts.pop_back();
+    }
+  }
+  return 0;
+}
+
+void BufferPool::discard(int i)
+{
+  used -= frames[i].size;
+  delete [] frames[i].data;
+  frames[i].data = NULL;
+  frames[i].size = 0;
+  spareFrames.push_back(i);
+}
+
+RC BufferPool::flush(int fid)
+{
+  FileInfo& info = files[fid];
+  struct iovec iov[MAX_FLUSH_RUN];
+
+  if (info.dirty.empty()) return 0;
+  if (info.fd < 0) return RC_FILE_WRITE_FAILED;
+
+  // the dirty set is ordered by pid. write each run of consecutive
+  // pages with a single pwritev().
+  while (!info.dirty.empty()) {
+    std::set<PageId>::iterator it = info.dirty.begin();
+    PageId first = *it;
+    int    n = 0;
+    for (; it != info.dirty.end() && *it == first + n && n < MAX_FLUSH_RUN; ++it) {
+      iov[n].iov_base = frames[find(fid, *it)].data;
+      iov[n].iov_len = info.pageSize;
+      n++;
+    }
+
+    long long start = IoStats::now();
+    if (::pwritev(info.fd, iov, n, info.base + (off_t) first * info.pageSize)
+        != (ssize_t) n * info.pageSize) {
+      return RC_FILE_WRITE_FAILED;
+    }
+    if (info.stats != NULL) {
+      info.stats->physicalWrite(n, (long long) n * info.pageSize, IoStats::now() - start);
+    }
+
+    // the run is clean now
+    for (int j = 0; j < n; j++) frames[find(fid, first + j)].dirty = false;
+    info.dirty.erase(info.dirty.begin(), it);
+    flushCount += n;
+  }
+
+  return 0;
+}
+
+void BufferPool::invalidateFile(int fid)
+{
+  // the page table is not ordered by file, so go over the frame table.
+  // this only happens when a file was changed behind our back.
+  for (int i = 0; i < (int) frames.size(); i++) {
+    if (frames[i].fid == fid && frames[i].pinCount == 0 && !frames[i].dirty) {
+      release(i);
+    }
+  }
+}
+
+void BufferPool::release(int i)
+{
+  Frame& frame = frames[i];
+  pageTable.erase(makeKey(frame.fid, frame.pid));
+  unlink(i);
+  frame.fid = -1;
+  frame.pid = 0;
+  classes[classOf(frame.size)].freeFrames.push_back(i);
+}
+
+void BufferPool::unlink(int i)
+{
+  Frame& frame = frames[i];
+  SizeClass& sc = classes[classOf(frame.size)];
+  Queue& q = frame.hot ? sc.am : sc.a1;
+
+  // a pinned frame is not in the list
+  if (frame.prev < 0 && frame.next < 0 && q.head != i) return;
+  if (frame.prev >= 0) frames[frame.prev].next = frame.next;
+  else q.head = frame.next;
+  if (frame.next >= 0) frames[frame.next].prev = frame.prev;
+  else q.tail = frame.prev;
+  frame.prev = frame.next = -1;
+  q.length--;
+}
+
+void BufferPool::linkHead(int i)
+{
+  Frame& frame = frames[i];
+  SizeClass& sc = classes[classOf(frame.size)];
+  Queue& q = frame.hot ? sc.am : sc.a1;
+  frame.prev = -1;
+  frame.next = q.head;
+  if (q.head >= 0) frames[q.head].prev = i;
+  q.head = i;
+  if (q.tail < 0) q.tail = i;
+  q.length++;
+}
+
+int BufferPool::classOf(int size)
+{
+  int c = 0;
+  while ((PageFile::MIN_PAGE_SIZE << c) < size) c++;
+  return c;
+}
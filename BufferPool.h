@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "IoStats.h"
+
+/**
+ * The buffer pool that caches disk pages in main memory.
+ * A single pool is shared by every open PageFile (and therefore by every
+ * RecordFile and BTreeIndex). Cached pages are identified by the pair
+ * (fid, pid), where fid is the id the pool assigned to the file the page
+ * belongs to. Since a file keeps its id when it is closed and reopened,
+ * its pages stay cached across queries.
+ *
+ * The pool consists of a frame table, which holds the page buffers and
+ * their bookkeeping information, and a page table, which maps a cached
+ * page to the frame that holds it. The page table is a hash table and the
+ * frames are linked in LRU order, so both a lookup and the choice of the
+ * page to evict take constant time regardless of the size of the pool.
+ *
+ * Files may have different page sizes. A frame has the size of the page
+ * it holds, and the frames of each page size have their own LRU lists.
+ * Frames are allocated on demand until the capacity of the pool is used
+ * up. A page then replaces a page of its own size, or, if there is none,
+ * enough pages of other sizes are evicted to make room for it.
+ *
+ * The page to replace is chosen by one of two policies. LRU replaces the
+ * least recently used page. 2Q keeps the pages that were used only once
+ * recently, e.g., by a table scan, in a separate queue (A1) and
+ * replaces them first, so a scan cannot push out the frequently used
+ * pages in the main LRU list (Am), such as the upper levels of a B+tree.
+ * A page enters Am when it is read again shortly after it left A1, which
+ * is detected with a list of the keys of the pages recently evicted from
+ * A1 (A1out).
+ *
+ * In write-back mode, a written page is only marked dirty in the pool.
+ * The dirty pages of a file are written to the disk in page-id order,
+ * with consecutive pages coalesced into a single write, when one of them
+ * is evicted, when the file is closed, or when flushFile() is called.
+ *
+ * The pool may be used by several threads at once. A frame is only
+ * accessed through a pin, which keeps the page from being evicted.
+ * A page that is not cached is read by the thread that pinned it first,
+ * outside of the pool latch. Other threads pinning the same page wait
+ * until the read is done.
+ */
+class BufferPool {
+ public:
+  static const int DEFAULT_SIZE_MB = 64;  // default capacity of the pool
+
+  /**
+   * the page replacement policy
+   */
+  enum Policy { LRU, TWO_Q };
+
+  /**
+   * @return the buffer pool shared by all PageFiles.
+   * the capacity of the pool is initialized from the environment variable
+   * BRUINBASE_BUFFER_POOL_MB if it is set, and DEFAULT_SIZE_MB otherwise.
+   */
+  static BufferPool& getInstance();
+
+  /**
+   * change the capacity of the pool. all cached pages are dropped.
+   * the capacity cannot be changed while a page is pinned.
+   * @param megabytes[IN] the new capacity in megabytes
+   * @return error code. 0 if no error
+   */
+  RC setCapacity(int megabytes);
+
+  /**
+   * @return the capacity of the pool in megabytes
+   */
+  int getCapacity() const { return capacityMB; }
+
+  /**
+   * @param pageSize[IN] the page size
+   * @return the number of pages of the given size that fit in the pool
+   */
+  int getFrameCount(int pageSize) const
+  { return (int) (capacity / pageSize); }
+
+  /**
+   * turn the write-back mode on or off. the mode is initialized from
+   * the environment variable BRUINBASE_WRITE_BACK. when the mode is
+   * turned off, all dirty pages are flushed first.
+   * @param on[IN] true for write-back, false for write-through
+   * @return error code. 0 if no error
+   */
+  RC setWriteBack(bool on);
+
+  /**
+   * @return true if the pool is in write-back mode
+   */
+  bool isWriteBack() const { return writeBack; }
+
+  /**
+   * @return the total # of dirty pages written to the disk by the pool
+   */
+  long long getFlushCount() const { return flushCount; }
+
+  /**
+   * change the page replacement policy. the policy is initialized from
+   * the environment variable BRUINBASE_REPLACEMENT ("lru" or "2q").
+   * the pages already cached keep their place.
+   * @param policy[IN] the new policy
+   */
+  void setPolicy(Policy policy);
+
+  /**
+   * @return the page replacement policy
+   */
+  Policy getPolicy() const { return policy; }
+
+  /**
+   * parse the name of a replacement policy.
+   * @param name[IN] "lru" or "2q"
+   * @param policy[OUT] the policy
+   * @return error code. 0 if no error
+   */
+  static RC parsePolicy(const char* name, Policy& policy);
+
+  /**
+   * @return the total # of pins that found the page cached
+   */
+  long long getHitCount() const { return hitCount; }
+
+  /**
+   * @return the total # of pins that had to read the page
+   */
+  long long getMissCount() const { return missCount; }
+
+  /**
+   * reset the hit and miss counters to zero.
+   */
+  void resetCounters();
+
+  /**
+   * register an opened file with the pool.
+   * if the file was modified since it was last closed, e.g., by another
+   * process, its stale pages are dropped from the pool.
+   * @param st[IN] the stat of the opened file
+   * @param fd[IN] the file descriptor used to write back dirty pages.
+   *               -1 if the file is opened read-only
+   * @param pageSize[IN] the page size of the file
+   * @param base[IN] the file offset of page 0
+   * @param stats[IN] the statistics to count the evictions and the
+   *                  written pages of the file in. NULL if none
+   * @return the id of the file used to identify its pages in the pool
+   */
+  int openFile(const struct stat& st, int fd, int pageSize, off_t base,
+               IoStats* stats = NULL);
+
+  /**
+   * record the state of a file that is about to be closed, so that
+   * its cached pages can be reused when the file is opened again.
+   * the dirty pages of the file must have been flushed.
+   * @param fid[IN] the id of the file
+   * @param fd[IN] the file descriptor being closed
+   * @param st[IN] the stat of the file
+   */
+  void closeFile(int fid, int fd, const struct stat& st);
+
+  /**
+   * pin a page in the pool and return the frame that holds it. the page
+   * is not evicted until every pin on it is released by unpin().
+   * if the page is not cached, a frame is assigned to it, evicting the
+   * least recently used page that is not pinned, and valid is set to
+   * false. the caller must then fill in the frame and call loaded().
+   * if the evicted page is dirty, the dirty pages of its file are
+   * flushed first.
+   * @param fid[IN] the id of the file the page belongs to
+   * @param pid[IN] the page to pin
+   * @param frame[OUT] pointer to the frame that holds the page
+   * @param valid[OUT] true if the frame holds the content of the page
+   * @param wait[IN] false to return RC_PAGE_BUSY instead of waiting when
+   *                 another thread is reading the page
+   * @return error code. 0 if no error.
+   *         RC_BUFFER_POOL_FULL if every frame is pinned
+   */
+  RC pin(int fid, PageId pid, char*& frame, bool& valid, bool wait = true);
+
+  /**
+   * finish filling in the frame of a page that pin() returned as invalid.
+   * if the frame could not be filled in, the pin is released and the
+   * page is dropped from the pool.
+   * @param fid[IN] the id of the file the page belongs to
+   * @param pid[IN] the page that was filled in
+   * @param ok[IN] false if the frame could not be filled in
+   */
+  void loaded(int fid, PageId pid, bool ok);
+
+  /**
+   * release a pin obtained by pin().
+   * @param fid[IN] the id of the file the page belongs to
+   * @param pid[IN] the page to unpin
+   */
+  void unpin(int fid, PageId pid);
+
+  /**
+   * mark a pinned page dirty, so that it is written to the disk later.
+   * @param fid[IN] the id of the file the page belongs to
+   * @param pid[IN] the page to mark
+   */
+  void markDirty(int fid, PageId pid);
+
+  /**
+   * write the dirty pages of a file to the disk in page-id order.
+   * @param fid[IN] the id of the file
+   * @return error code. 0 if no error
+   */
+  RC flushFile(int fid);
+
+  /**
+   * write the dirty pages of every file to the disk.
+   * @return error code. 0 if no error
+   */
+  RC flushAll();
+
+ private:
+  BufferPool(int megabytes);
+  ~BufferPool();
+
+  // the key of the page table. (fid, pid) packed into 64 bits.
+  typedef unsigned long long PageKey;
+  static PageKey makeKey(int fid, PageId pid)
+  { return ((PageKey) (unsigned) fid << 32) | (unsigned) pid; }
+
+  // the identity and the last known state of a registered file
+  struct FileInfo {
+    dev_t  dev;     // device of the file
+    ino_t  ino;     // inode of the file
+    off_t  size;    // file size when the file was last closed
+    time_t mtime;   // modification time when the file was last closed
+    int    fd;      // descriptor for writing back dirty pages. -1 if none
+    int    pageSize;// the page size of the file
+    off_t  base;    // the file offset of page 0
+    IoStats* stats; // the statistics of the file. NULL if none
+    std::set<PageId> dirty;  // the dirty pages of the file in pid order
+  };
+
+  // an entry in the frame table
+  struct Frame {
+    int    fid;     // file id of the cached page. -1 if the frame is empty
+    PageId pid;     // page id of the cached page
+    int    prev;    // the previous (more recently used) frame in LRU list
+    int    next;    // the next (less recently used) frame in LRU list
+    int    pinCount;// # pins on the page. a pinned page is not in LRU list
+    bool   dirty;   // true if the page has not been written to the disk
+    bool   loading; // true while the page is being read into the frame
+    bool   hot;     // true if the frame is in Am, false if in A1
+    int    size;    // the size of the buffer. 0 if the frame has no buffer
+    char*  data;    // the buffer that holds the page
+  };
+
+  // a list of unpinned frames ordered by the time of their last unpin
+  struct Queue {
+    int head;       // the most recently used frame
+    int tail;       // the least recently used frame
+    int length;     // # frames in the list
+  };
+
+  // the frames of a single page size
+  struct SizeClass {
+    Queue a1;       // the pages used once recently. empty under LRU
+    Queue am;       // the other pages
+    std::vector<int> freeFrames;  // indices of the empty frames
+  };
+
+  // the # of page sizes from MIN_PAGE_SIZE to MAX_PAGE_SIZE
+  static const int SIZE_CLASSES = 5;
+
+  // the size class of a page size
+  static int classOf(int size);
+
+  //
+  // the following functions must be called with the latch held
+  //
+
+  // find the frame that holds the page. -1 if the page is not cached
+  int find(int fid, PageId pid) const;
+
+  // assign a frame to the page, evicting a page if necessary
+  RC allocate(int fid, PageId pid, int& i);
+
+  // evict pages of other sizes until size bytes are available
+  RC reclaim(int size, int keep);
+
+  // choose the frame to evict among the frames of a size. -1 if none
+  int victim(const SizeClass& sc) const;
+
+  // evict the page in frame i, writing it first if it is dirty
+  RC evict(int i);
+
+  // free the buffer of the empty frame i
+  void discard(int i);
+
+  // write the dirty pages of a file to the disk
+  RC flush(int fid);
+
+  // drop every cached page of a file that is clean and not pinned
+  void invalidateFile(int fid);
+
+  // free the frame i and remove it from the page table
+  void release(int i);
+
+  // unlink the frame i from its list
+  void unlink(int i);
+
+  // link the frame i at the head (most recently used end) of its list
+  void linkHead(int i);
+
+  std::mutex                latch;       // protects all members below
+  std::condition_variable   loadDone;    // signaled when a page is loaded
+  int                       capacityMB;  // capacity of the pool in megabytes
+  size_t                    capacity;    // capacity of the pool in bytes
+  size_t                    used;        // # bytes in the frame buffers
+  std::vector<Frame>        frames;      // the frame table
+  std::unordered_map<PageKey, int> pageTable;  // (fid, pid) -> frame index
+  SizeClass                 classes[SIZE_CLASSES];  // frames by page size
+  std::vector<int>          spareFrames; // indices of frames without buffer
+  std::vector<FileInfo>     files;       // registered files indexed by fid
+  std::list<PageKey>        ghosts;      // A1out. most recently evicted first
+  std::unordered_map<PageKey, std::list<PageKey>::iterator> ghostTable;
+  std::atomic<bool>         writeBack;   // true in write-back mode. read
+                                         // without the latch by isWriteBack()
+  // the policy and the counters are written under the latch, and read
+  // without it by their getters
+  std::atomic<Policy>       policy;      // the page replacement policy
+  std::atomic<long long>    flushCount;  // total # of dirty pages written
+  std::atomic<long long>    hitCount;    // total # of pins on cached pages
+  std::atomic<long long>    missCount;   // total # of pins on uncached pages
+};
+
+#endif // BUFFERPOOL_H
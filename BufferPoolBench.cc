@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+//
+// microbenchmark for the buffer pool.
+// measures the cost of pinning and unpinning a cached page (cache hit)
+// and a page that is not cached, which evicts another page (cache miss),
+// as the pool grows. both should stay flat since neither operation
+// depends on the number of frames. the page contents are never touched,
+// so only the bookkeeping is timed.
+//
+// it then compares the hit rates of the replacement policies on a mixed
+// workload, where point lookups on an index keep reusing a set of pages
+// while a table scan reads a long run of pages once each.
+//
+// usage: bufferpool_bench [page size]
+//
+
+#include "BufferPool.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+static const int OPS = 2000000;
+
+// the mixed workload runs on a pool of this many megabytes
+static const int MIXED_POOL_MB = 4;
+
+// pin a page, reading it if it is not cached, and unpin it
+static void touch(BufferPool& pool, int fid, PageId pid)
+{
+  char* frame;
+  bool  valid;
+
+  if (pool.pin(fid, pid, frame, valid) < 0) return;
+  if (!valid) pool.loaded(fid, pid, true);
+  pool.unpin(fid, pid);
+}
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+  static const int sizes[] = { 1, 4, 16, 64, 256 };
+  BufferPool& pool = BufferPool::getInstance();
+  std::vector<PageId> probes(OPS);
+  unsigned seed = 12345;
+  unsigned long sum = 0;
+  char* frame;
+  bool  valid;
+  int   pageSize = (argc > 1) ? atoi(argv[1]) : PageFile::DEFAULT_PAGE_SIZE;
+  int   fids[3];
+
+  if (!PageFile::isValidPageSize(pageSize)) {
+    fprintf(stderr, "Error: invalid page size %s\n", argv[1]);
+    return 1;
+  }
+
+  // register three files that only exist in the pool
+  for (int f = 0; f < 3; f++) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_ino = f + 1;
+    fids[f] = pool.openFile(st, -1, pageSize, 0);
+  }
+
+  printf("%10s %10s %16s %16s\n", "pool_mb", "frames", "hit_ns_per_op", "miss_ns_per_op");
+  for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    pool.setCapacity(sizes[s]);
+    int frames = pool.getFrameCount(pageSize);
+
+    // fill the pool with the pages 0 .. frames-1 of two files
+    for (PageId pid = 0; pid < frames; pid++) {
+      pool.pin(fids[pid & 1], pid, frame, valid);
+      pool.loaded(fids[pid & 1], pid, true);
+      pool.unpin(fids[pid & 1], pid);
+    }
+
+    // look up random resident pages
+    for (int i = 0; i < OPS; i++) {
+      seed = seed * 1103515245 + 12345;
+      probes[i] = (seed >> 1) % frames;
+    }
+    double begin = now();
+    for (int i = 0; i < OPS; i++) {
+      pool.pin(fids[probes[i] & 1], probes[i], frame, valid);
+      pool.unpin(fids[probes[i] & 1], probes[i]);
+      sum += (unsigned long) frame;
+    }
+    double hit = (now() - begin) * 1e9 / OPS;
+
+    // pin pages that are not cached. each one evicts the LRU page.
+    begin = now();
+    for (int i = 0; i < OPS; i++) {
+      pool.pin(fids[2], frames + i, frame, valid);
+      pool.loaded(fids[2], frames + i, true);
+      pool.unpin(fids[2], frames + i);
+      sum += (unsigned long) frame;
+    }
+    double miss = (now() - begin) * 1e9 / OPS;
+
+    printf("%10d %10d %16.1f %16.1f\n", sizes[s], frames, hit, miss);
+  }
+
+  // index lookups on a working set of half the pool, interleaved with
+  // a scan of eight times the pool size. the scan touches each of its
+  // pages several times in a row, once per record.
+  static const BufferPool::Policy policies[] = { BufferPool::LRU, BufferPool::TWO_Q };
+  static const char* names[] = { "lru", "2q" };
+  printf("\n%10s %10s %16s %16s\n", "policy", "frames", "lookup_hit_pct", "total_hit_pct");
+  for (int p = 0; p < 2; p++) {
+    pool.setCapacity(MIXED_POOL_MB);
+    pool.setPolicy(policies[p]);
+    int frames = pool.getFrameCount(pageSize);
+    int hotPages = frames / 2;
+
+    // warm up the index before the scan starts
+    for (int i = 0; i < 4 * hotPages; i++) {
+      seed = seed * 1103515245 + 12345;
+      touch(pool, fids[0], (seed >> 1) % hotPages);
+    }
+
+    long long lookupHits = 0, lookups = 0;
+    pool.resetCounters();
+    for (PageId scan = 0; scan < 8 * frames; scan++) {
+      for (int r = 0; r < 8; r++) touch(pool, fids[1], scan);
+
+      seed = seed * 1103515245 + 12345;
+      long long hits = pool.getHitCount();
+      touch(pool, fids[0], (seed >> 1) % hotPages);
+      lookupHits += pool.getHitCount() - hits;
+      lookups++;
+    }
+    long long total = pool.getHitCount() + pool.getMissCount();
+
+    printf("%10s %10d %16.1f %16.1f\n", names[p], frames,
+           100.0 * lookupHits / lookups, 100.0 * pool.getHitCount() / total);
+  }
+
+  // print the checksum so that the compiler cannot drop the lookups
+  fprintf(stderr, "checksum %lu\n", sum);
+  return 0;
+}
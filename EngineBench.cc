@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+//
+// benchmark suite for the query engine.
+// for each table size, a load file in the format of movie.del is
+// generated with a fixed seed, so every run works on the same data.
+// the benchmarks then time
+//
+//   load        SqlEngine::load without an index
+//   load_index  SqlEngine::load with an index
+//   scan        SELECT * over the whole table
+//   count       SELECT COUNT(*) over the whole table
+//   point       BTreeIndex::locate of a random key and the read of its tuple
+//   range       BTreeIndex::locate of a random key and an IndexScan over
+//               the next RANGE_LENGTH entries, reading their tuples
+//   fetch       the range scan above, reading the tuples of the entries
+//               with a single RecordFile::readBatch. the tuples are checked
+//               against RecordFile::read, and a difference stops the run
+//   batch       BTreeIndex::locateBatch of BATCH_LENGTH random keys, without
+//               reading the tuples
+//
+// the read benchmarks run once with pread() through the buffer pool and
+// once with the files memory-mapped. every benchmark prints a line with
+// the # of timed operations, the # of tuples they went through, the
+// throughput and the median and 99th percentile latency of an operation.
+//
+// usage: engine_bench [--rows N[,N...]] [--ops N] [--repeat N]
+//                     [--format csv|json] [--dir DIR]
+//
+
+#include "BTreeIndex.h"
+#include "RecordFile.h"
+#include "SqlEngine.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+
+// the # of index entries read by a range scan
+static const int RANGE_LENGTH = 100;
+
+// the # of keys looked up by a batch
+static const int BATCH_LENGTH = 1000;
+
+// a deterministic random number generator, so that runs are comparable
+static unsigned long long seed = 88172645463325252ULL;
+static unsigned long long nextRandom()
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 7;
+  seed ^= seed << 17;
+  return seed;
+}
+
+static long long nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static long long gcd(long long a, long long b)
+{
+  while (b != 0) { long long t = a % b; a = b; b = t; }
+  return a;
+}
+
+/**
+ * the result of a benchmark
+ */
+struct Result {
+  string    name;     // the name of the benchmark
+  long long rows;     // the # of tuples in the table
+  string    io;       // "pread" or "mmap"
+  long long ops;      // the # of timed operations
+  long long items;    // the # of tuples the operations went through
+  double    seconds;  // the total time of the operations
+  double    p50;      // the median latency of an operation in microseconds
+  double    p99;      // the 99th percentile latency in microseconds
+};
+
+static vector<Result> results;
+static bool json = false;
+
+// record the result of a benchmark from the latencies of its operations
+static void report(const string& name, long long rows, const string& io,
+                   vector<long long>& latencies, long long items)
+{
+  Result r;
+  long long total = 0;
+
+  std::sort(latencies.begin(), latencies.end());
+  for (unsigned i = 0; i < latencies.size(); i++) total += latencies[i];
+
+  r.name = name;
+  r.rows = rows;
+  r.io = io;
+  r.ops = (long long) latencies.size();
+  r.items = items;
+  r.seconds = total / 1e9;
+  r.p50 = r.ops ? latencies[(r.ops - 1) / 2] / 1e3 : 0;
+  r.p99 = r.ops ? latencies[(r.ops - 1) * 99 / 100] / 1e3 : 0;
+  results.push_back(r);
+
+  fprintf(stderr, "%-12s %10lld rows %-6s %10.3f s\n", name.c_str(), rows, io.c_str(), r.seconds);
+}
+
+static void printResults()
+{
+  if (json) fprintf(stdout, "[\n");
+  else fprintf(stdout, "benchmark,rows,io,ops,items,seconds,ops_per_sec,items_per_sec,p50_us,p99_us\n");
+
+  for (unsigned i = 0; i < results.size(); i++) {
+    const Result& r = results[i];
+    double opsPerSec = (r.seconds > 0) ? r.ops / r.seconds : 0;
+    double itemsPerSec = (r.seconds > 0) ? r.items / r.seconds : 0;
+
+    if (json) {
+      fprintf(stdout, "  {\"benchmark\": \"%s\", \"rows\": %lld, \"io\": \"%s\", \"ops\": %lld, "
+              "\"items\": %lld, \"seconds\": %.6f, \"ops_per_sec\": %.3f, \"items_per_sec\": %.1f, "
+              "\"p50_us\": %.1f, \"p99_us\": %.1f}%s\n",
+              r.name.c_str(), r.rows, r.io.c_str(), r.ops, r.items, r.seconds, opsPerSec,
+              itemsPerSec, r.p50, r.p99, (i + 1 < results.size()) ? "," : "");
+    } else {
+      fprintf(stdout, "%s,%lld,%s,%lld,%lld,%.6f,%.3f,%.1f,%.1f,%.1f\n",
+              r.name.c_str(), r.rows, r.io.c_str(), r.ops, r.items, r.seconds, opsPerSec,
+              itemsPerSec, r.p50, r.p99);
+    }
+  }
+
+  if (json) fprintf(stdout, "]\n");
+}
+
+// write a load file of n tuples. the keys 1..n are permuted by a
+// multiplicative step, so the tuples are not loaded in key order.
+static RC generate(const string& filename, long long n)
+{
+  static const char letters[] = "abcdefghijklmnopqrstuvwxyz     ";
+  FILE* f;
+  long long step = 1000003;
+
+  if ((f = fopen(filename.c_str(), "w")) == NULL) return RC_FILE_OPEN_FAILED;
+
+  while (gcd(step, n) != 1) step += 2;
+  for (long long i = 0; i < n; i++) {
+    char value[RecordFile::MAX_VALUE_LENGTH];
+    int  length = 8 + (int) (nextRandom() % 40);
+    for (int j = 0; j < length; j++) value[j] = letters[nextRandom() % (sizeof(letters) - 1)];
+    value[0] = 'A' + (int) (nextRandom() % 26);
+    value[length] = 0;
+    fprintf(f, "%lld,\"%s\"\n", (i * step) % n + 1, value);
+  }
+
+  return (fclose(f) == 0) ? 0 : RC_FILE_WRITE_FAILED;
+}
+
+// time the load of a table
+static RC benchLoad(const string& name, const string& table, const string& loadfile,
+                    long long rows, bool index)
+{
+  vector<long long> latencies;
+  RC                rc;
+
+  // load appends to an existing table
+  unlink((table + ".tbl").c_str());
+  unlink((table + ".idx").c_str());
+
+  long long begin = nowNs();
+  if ((rc = SqlEngine::load(table, loadfile, index)) != 0) {
+    fprintf(stderr, "Error: cannot load %s (%d)\n", table.c_str(), rc);
+    return rc;
+  }
+  latencies.push_back(nowNs() - begin);
+  report(name, rows, "pread", latencies, rows);
+  return 0;
+}
+
+// time a select statement over the whole table
+static void benchSelect(const string& name, const string& table, int attr,
+                        long long rows, const string& io, int repeat)
+{
+  vector<long long> latencies;
+  vector<SelCond>   conds;
+  SelOrder          order = { SelOrder::NONE, -1 };
+  SelStats          stats;
+  long long         items = 0;
+
+  for (int i = 0; i < repeat; i++) {
+    long long begin = nowNs();
+    SqlEngine::select(attr, table, conds, order, &stats);
+    latencies.push_back(nowNs() - begin);
+    items += stats.scanned;
+  }
+  report(name, rows, io, latencies, items);
+}
+
+// time point lookups or range scans of random keys through the index
+static void benchIndex(const string& name, const string& table, long long rows,
+                       const string& io, int ops, int length)
+{
+  vector<long long> latencies;
+  BTreeIndex  index;
+  RecordFile  rf;
+  IndexScan   scan;
+  long long   items = 0;
+
+  if (index.open(table + ".idx", 'r') != 0 || rf.open(table + ".tbl", 'r') < 0) {
+    fprintf(stderr, "Error: cannot open table %s\n", table.c_str());
+    return;
+  }
+
+  for (int i = 0; i < ops; i++) {
+    int         searchKey = (int) (nextRandom() % rows) + 1;
+    IndexCursor cursor;
+    RecordId    rid;
+    string      value;
+    int         key;
+    RC          rc;
+
+    long long begin = nowNs();
+    rc = index.locate(searchKey, cursor);
+    if (rc < 0 && rc != RC_NO_SUCH_RECORD) break;
+    if (scan.open(index, cursor) < 0) break;
+    for (int j = 0; j < length && scan.next(key, rid) == 0; j++) {
+      rf.read(rid, key, value);
+      items++;
+    }
+    latencies.push_back(nowNs() - begin);
+  }
+
+  scan.close();
+  rf.close();
+  index.close();
+  report(name, rows, io, latencies, items);
+}
+
+// time range scans of random keys through the index, reading the tuples
+// of each scan at once, and check the tuples against the ones read one
+// by one outside of the timing
+static RC benchFetch(const string& name, const string& table, long long rows,
+                     const string& io, int ops)
+{
+  vector<long long> latencies;
+  vector<int>       keys(RANGE_LENGTH), tupleKeys(RANGE_LENGTH);
+  vector<RecordId>  rids(RANGE_LENGTH);
+  vector<string>    values(RANGE_LENGTH);
+  BTreeIndex  index;
+  RecordFile  rf;
+  IndexScan   scan;
+  long long   items = 0;
+  RC          rc = 0;
+
+  if (index.open(table + ".idx", 'r') != 0 || rf.open(table + ".tbl", 'r') < 0) {
+    fprintf(stderr, "Error: cannot open table %s\n", table.c_str());
+    return RC_FILE_OPEN_FAILED;
+  }
+
+  for (int i = 0; i < ops; i++) {
+    int         searchKey = (int) (nextRandom() % rows) + 1;
+    IndexCursor cursor;
+    int         n = 0;
+
+    long long begin = nowNs();
+    rc = index.locate(searchKey, cursor);
+    if (rc < 0 && rc != RC_NO_SUCH_RECORD) break;
+    if ((rc = scan.open(index, cursor)) < 0) break;
+    while (n < RANGE_LENGTH && (rc = scan.read(&keys[n], &rids[n], RANGE_LENGTH - n)) > 0) n += rc;
+    if (rc < 0 || (rc = rf.readBatch(&rids[0], n, &tupleKeys[0], &values[0])) < 0) break;
+    latencies.push_back(nowNs() - begin);
+    items += n;
+
+    for (int j = 0; j < n; j++) {
+      int    key;
+      string value;
+      if ((rc = rf.read(rids[j], key, value)) < 0) break;
+      if (key != keys[j] || key != tupleKeys[j] || value != values[j]) {
+        fprintf(stderr, "Error: readBatch() and read() differ at tuple (%d, %d) of %s\n",
+                rids[j].pid, rids[j].sid, table.c_str());
+        rc = RC_FILE_READ_FAILED;
+        break;
+      }
+    }
+    if (rc < 0) break;
+  }
+
+  scan.close();
+  rf.close();
+  index.close();
+  if (rc < 0) {
+    fprintf(stderr, "Error: %s failed on table %s (%d)\n", name.c_str(), table.c_str(), rc);
+    return rc;
+  }
+  report(name, rows, io, latencies, items);
+  return 0;
+}
+
+// time lookups of random keys in batches through the index
+static void benchBatch(const string& name, const string& table, long long rows,
+                       const string& io, int ops)
+{
+  vector<long long>   latencies;
+  vector<int>         keys(BATCH_LENGTH);
+  vector<IndexCursor> cursors(BATCH_LENGTH);
+  BTreeIndex index;
+  long long  items = 0;
+
+  if (index.open(table + ".idx", 'r') != 0) {
+    fprintf(stderr, "Error: cannot open table %s\n", table.c_str());
+    return;
+  }
+
+  for (int i = 0; i < ops; i++) {
+    for (int j = 0; j < BATCH_LENGTH; j++) keys[j] = (int) (nextRandom() % rows) + 1;
+
+    long long begin = nowNs();
+    RC rc = index.locateBatch(&keys[0], BATCH_LENGTH, &cursors[0]);
+    if (rc < 0) break;
+    latencies.push_back(nowNs() - begin);
+    items += rc;
+  }
+
+  index.close();
+  report(name, rows, io, latencies, items);
+}
+
+static void usage(const char* prog)
+{
+  fprintf(stderr, "usage: %s [--rows N[,N...]] [--ops N] [--repeat N]\n"
+          "       [--format csv|json] [--dir DIR]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+  vector<long long> sizes;
+  string dir = ".";
+  int    ops = 10000;
+  int    repeat = 3;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rows") == 0 && i + 1 < argc) {
+      for (char* s = strtok(argv[++i], ","); s != NULL; s = strtok(NULL, ",")) {
+        sizes.push_back(atoll(s));
+      }
+    } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+      ops = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      json = (strcmp(argv[++i], "json") == 0);
+    } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+      dir = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (sizes.empty()) {
+    sizes.push_back(1000000);
+    sizes.push_back(10000000);
+    sizes.push_back(100000000);
+  }
+  if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+    fprintf(stderr, "Error: cannot create directory %s\n", dir.c_str());
+    return 1;
+  }
+
+  for (unsigned s = 0; s < sizes.size(); s++) {
+    long long rows = sizes[s];
+    char      suffix[32];
+    snprintf(suffix, sizeof(suffix), "%lld", rows);
+    string loadfile = dir + "/bench" + suffix + ".del";
+    string plain = dir + "/bench" + suffix;
+    string indexed = dir + "/bench" + suffix + "i";
+    struct stat st;
+
+    if (stat(loadfile.c_str(), &st) < 0 && generate(loadfile, rows) < 0) {
+      fprintf(stderr, "Error: cannot write %s\n", loadfile.c_str());
+      return 1;
+    }
+
+    if (benchLoad("load", plain, loadfile, rows, false) != 0 ||
+        benchLoad("load_index", indexed, loadfile, rows, true) != 0) {
+      return 1;
+    }
+
+    // the same reads through the buffer pool and through a mapping
+    for (int m = 0; m < 2; m++) {
+      string io = m ? "mmap" : "pread";
+      PageFile::setMemoryMapped(m != 0);
+      benchSelect("scan", plain, 3, rows, io, repeat);
+      benchSelect("count", plain, 4, rows, io, repeat);
+      benchIndex("point", indexed, rows, io, ops, 1);
+      benchIndex("range", indexed, rows, io, ops / 10, RANGE_LENGTH);
+      if (benchFetch("fetch", indexed, rows, io, ops / 10) != 0) return 1;
+      benchBatch("batch", indexed, rows, io, ops / 100);
+    }
+    PageFile::setMemoryMapped(false);
+  }
+
+  printResults();
+  return 0;
+}
@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "IoBatch.h"
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+// the # of threads issuing preads when io_uring is not used
+static const int READ_THREADS = 8;
+
+// a request that has not completed yet
+static const ssize_t IN_FLIGHT = -EINPROGRESS;
+
+static std::atomic<bool> useUring(getenv("BRUINBASE_IO_URING") == NULL ||
+                                  atoi(getenv("BRUINBASE_IO_URING")) != 0);
+
+// read a request synchronously. a partial read is continued, so the
+// result is short only at the end of the file
+static void readOne(int fd, IoRequest& req)
+{
+  size_t total = 0;
+
+  while (total < req.length) {
+    ssize_t n = ::pread(fd, req.buffer + total, req.length - total, req.offset + total);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      req.result = -errno;
+      return;
+    }
+    if (n == 0) break;
+    total += n;
+  }
+  req.result = (ssize_t) total;
+}
+
+#ifdef HAVE_IO_URING
+
+/**
+ * an io_uring owned by a single thread. the rings are set up with the
+ * raw system calls, so liburing is not needed.
+ */
+class Uring {
+ public:
+  Uring();
+  ~Uring();
+
+  // true if the ring was set up
+  bool ok() const { return ringFd >= 0; }
+
+  // read every request and wait until all of them are done
+  void read(int fd, IoRequest* reqs, int n);
+
+ private:
+  // unmap and close the ring
+  void teardown();
+
+  // take the completions off the queue and store their results.
+  // returns the # of completions taken
+  int reap(int fd, IoRequest* reqs);
+
+  int       ringFd;   // the ring. -1 if the setup failed
+  unsigned  entries;  // # of entries in the submission queue
+  unsigned* sqHead;   // the submission queue, shared with the kernel
+  unsigned* sqTail;
+  unsigned* sqMask;
+  unsigned* sqArray;
+  unsigned* cqHead;   // the completion queue, shared with the kernel
+  unsigned* cqTail;
+  unsigned* cqMask;
+  struct io_uring_sqe* sqes;
+  struct io_uring_cqe* cqes;
+  void*     sqRing;   // the mappings of the rings
+  size_t    sqSize;
+  void*     cqRing;
+  size_t    cqSize;
+  size_t    sqesSize;
+};
+
+Uring::Uring()
+{
+  struct io_uring_params p;
+
+  sqRing = cqRing = MAP_FAILED;
+  sqes = (struct io_uring_sqe*) MAP_FAILED;
+
+  memset(&p, 0, sizeof(p));
+  ringFd = (int) syscall(__NR_io_uring_setup, IoBatch::QUEUE_DEPTH, &p);
+  if (ringFd < 0) return;
+
+  // map the submission queue, the completion queue and the sqe array
+  entries = p.sq_entries;
+  sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+  sqRing = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ringFd, IORING_OFF_SQ_RING);
+  cqRing = mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ringFd, IORING_OFF_CQ_RING);
+  sqes = (struct io_uring_sqe*) mmap(NULL, sqesSize, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+  if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+    teardown();
+    return;
+  }
+
+  char* sq = (char*) sqRing;
+  char* cq = (char*) cqRing;
+  sqHead = (unsigned*) (sq + p.sq_off.head);
+  sqTail = (unsigned*) (sq + p.sq_off.tail);
+  sqMask = (unsigned*) (sq + p.sq_off.ring_mask);
+  sqArray = (unsigned*) (sq + p.sq_off.array);
+  cqHead = (unsigned*) (cq + p.cq_off.head);
+  cqTail = (unsigned*) (cq + p.cq_off.tail);
+  cqMask = (unsigned*) (cq + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+}
+
+Uring::~Uring()
+{
+  teardown();
+}
+
+void Uring::teardown()
+{
+  if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+  if (cqRing != MAP_FAILED) munmap(cqRing, cqSize);
+  if (sqRing != MAP_FAILED) munmap(sqRing, sqSize);
+  if (ringFd >= 0) ::close(ringFd);
+  sqRing = cqRing = MAP_FAILED;
+  sqes = (struct io_uring_sqe*) MAP_FAILED;
+  ringFd = -1;
+}
+
+// the ring of the calling thread. it is set up on first use.
+static Uring& threadRing()
+{
+  thread_local Uring ring;
+  return ring;
+}
+
+void Uring::read(int fd, IoRequest* reqs, int n)
+{
+  int next = 0;   // the next request to queue
+  int done = 0;   // # of completed requests
+
+  for (int i = 0; i < n; i++) reqs[i].result = IN_FLIGHT;
+
+  while (done < n) {
+    // fill the submission queue. we are its only producer.
+    unsigned tail = *sqTail;
+    while (next < n && next - done < (int) entries) {
+      unsigned idx = tail & *sqMask;
+      struct io_uring_sqe* sqe = &sqes[idx];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = fd;
+      sqe->off = reqs[next].offset;
+      sqe->addr = (unsigned long) reqs[next].buffer;
+      sqe->len = (unsigned) reqs[next].length;
+      sqe->user_data = next;
+      sqArray[idx] = idx;
+      tail++;
+      next++;
+    }
+    __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+    // submit the queued requests and wait for at least one completion
+    unsigned toSubmit = tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (syscall(__NR_io_uring_enter, ringFd, toSubmit, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+
+      // the ring is unusable. take back the requests the kernel has not
+      // taken, and wait for the ones it has, so that no read lands in a
+      // buffer after we return. the rest is read synchronously, and the
+      // ring is closed so that later batches go to the read threads.
+      unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+      int taken = next - (int) (tail - head);
+      __atomic_store_n(sqTail, head, __ATOMIC_RELEASE);
+      while (done < taken) {
+        if (syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+          sched_yield();
+        }
+        done += reap(fd, reqs);
+      }
+      for (int i = 0; i < n; i++) {
+        if (reqs[i].result == IN_FLIGHT) readOne(fd, reqs[i]);
+      }
+      teardown();
+      return;
+    }
+
+    done += reap(fd, reqs);
+  }
+}
+
+int Uring::reap(int fd, IoRequest* reqs)
+{
+  int count = 0;
+  unsigned head = *cqHead;
+
+  while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe* cqe = &cqes[head & *cqMask];
+    IoRequest& req = reqs[cqe->user_data];
+    req.result = cqe->res;
+    head++;
+    count++;
+
+    // an old kernel without IORING_OP_READ rejects the request
+    if (req.result == -EINVAL) readOne(fd, req);
+  }
+  __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+  return count;
+}
+
+#endif // HAVE_IO_URING
+
+/**
+ * a pool of threads that issue queued reads with pread()
+ */
+class ReadPool {
+ public:
+  ReadPool();
+
+  // read every request and wait until all of them are done
+  void read(int fd, IoRequest* reqs, int n);
+
+ private:
+  struct Task {
+    int        fd;
+    IoRequest* req;
+    int*       remaining;  // # of unfinished requests in the batch
+  };
+
+  // the main loop of a worker thread
+  void work();
+
+  std::mutex              latch;     // protects the queue and the counters
+  std::condition_variable queued;    // signaled when a task is queued
+  std::condition_variable finished;  // signaled when a batch is done
+  std::deque<Task>        tasks;     // the reads that have not started
+};
+
+ReadPool::ReadPool()
+{
+  // the workers live until the process exits
+  for (int i = 0; i < READ_THREADS; i++) {
+    std::thread(&ReadPool::work, this).detach();
+  }
+}
+
+void ReadPool::read(int fd, IoRequest* reqs, int n)
+{
+  int remaining = n;
+  std::unique_lock<std::mutex> lock(latch);
+
+  for (int i = 0; i < n; i++) {
+    Task task = { fd, &reqs[i], &remaining };
+    tasks.push_back(task);
+  }
+  queued.notify_all();
+
+  while (remaining > 0) finished.wait(lock);
+}
+
+void ReadPool::work()
+{
+  std::unique_lock<std::mutex> lock(latch);
+
+  for (;;) {
+    while (tasks.empty()) queued.wait(lock);
+    Task task = tasks.front();
+    tasks.pop_front();
+
+    lock.unlock();
+    readOne(task.fd, *task.req);
+    lock.lock();
+
+    if (--*task.remaining == 0) finished.notify_all();
+  }
+}
+
+/**
+ * the I/O thread that reads the batches queued by readAsync()
+ */
+class AsyncReader {
+ public:
+  AsyncReader();
+
+  // a batch of background reads
+  struct Job {
+    int                    fd;
+    std::vector<IoRequest> reqs;
+    IoBatch::Callback      done;
+    void*                  arg;
+  };
+
+  // queue a batch for the I/O thread
+  void submit(Job* job);
+
+ private:
+  // the main loop of the I/O thread
+  void work();
+
+  std::mutex              latch;   // protects the queue
+  std::condition_variable queued;  // signaled when a batch is queued
+  std::deque<Job*>        jobs;    // the batches that have not started
+};
+
+AsyncReader::AsyncReader()
+{
+  // the thread lives until the process exits
+  std::thread(&AsyncReader::work, this).detach();
+}
+
+void AsyncReader::submit(Job* job)
+{
+  std::lock_guard<std::mutex> lock(latch);
+  jobs.push_back(job);
+  queued.notify_one();
+}
+
+void AsyncReader::work()
+{
+  for (;;) {
+    Job* job;
+    {
+      std::unique_lock<std::mutex> lock(latch);
+      while (jobs.empty()) queued.wait(lock);
+      job = jobs.front();
+      jobs.pop_front();
+    }
+
+    IoBatch::read(job->fd, job->reqs.data(), (int) job->reqs.size());
+    job->done(job->arg, job->reqs.data(), (int) job->reqs.size());
+    delete job;
+  }
+}
+
+void IoBatch::read(int fd, IoRequest* reqs, int n)
+{
+  // a single read does not need to be queued
+  if (n <= 0) return;
+  if (n == 1) {
+    readOne(fd, reqs[0]);
+    return;
+  }
+
+#ifdef HAVE_IO_URING
+  if (useUring && threadRing().ok()) {
+    threadRing().read(fd, reqs, n);
+    return;
+  }
+#endif
+
+  // the pool is never destroyed, since its threads are never joined
+  static ReadPool* pool = new ReadPool();
+  pool->read(fd, reqs, n);
+}
+
+void IoBatch::readAsync(int fd, const IoRequest* reqs, int n, Callback done, void* arg)
+{
+  // the reader is never destroyed, since its thread is never joined
+  static AsyncReader* reader = new AsyncReader();
+
+  AsyncReader::Job* job = new AsyncReader::Job;
+  job->fd = fd;
+  job->reqs.assign(reqs, reqs + n);
+  job->done = done;
+  job->arg = arg;
+  reader->submit(job);
+}
+
+void IoBatch::setUring(bool on)
+{
+  useUring = on;
+}
+
+bool IoBatch::isUring()
+{
+#ifdef HAVE_IO_URING
+  if (useUring) return threadRing().ok();
+#endif
+  return false;
+}
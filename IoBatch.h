@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef IOBATCH_H
+#define IOBATCH_H
+
+#include <sys/types.h>
+
+/**
+ * a single read in a batch
+ */
+struct IoRequest {
+  off_t   offset;   // the file offset to read from
+  char*   buffer;   // the buffer to read into
+  size_t  length;   // the # of bytes to read
+  ssize_t result;   // OUT: the # of bytes read. negative errno on failure
+};
+
+/**
+ * submit many reads on a file at once, so that the device sees more than
+ * one outstanding request. the reads are submitted to an io_uring of the
+ * calling thread when the kernel supports it. otherwise they are handed
+ * to a shared pool of threads that issue them with pread().
+ * a batch can also be read in the background by a dedicated I/O thread.
+ */
+class IoBatch {
+ public:
+  // the maximum # of reads that are in flight at once
+  static const int QUEUE_DEPTH = 64;
+
+  /**
+   * read every request of the batch and wait until all of them are done.
+   * the result of each read is returned in its result field.
+   * @param fd[IN] the file to read from
+   * @param reqs[IN/OUT] the reads to issue
+   * @param n[IN] the # of reads
+   */
+  static void read(int fd, IoRequest* reqs, int n);
+
+  /**
+   * the function called by the I/O thread when a background batch is done
+   * @param arg[IN] the argument given to readAsync()
+   * @param reqs[IN] the reads with their results
+   * @param n[IN] the # of reads
+   */
+  typedef void (*Callback)(void* arg, IoRequest* reqs, int n);
+
+  /**
+   * queue a batch of reads for the I/O thread and return immediately.
+   * the batches are read one after another in the order they are queued.
+   * the buffers must stay valid until done is called.
+   * @param fd[IN] the file to read from. it must stay open until done is called
+   * @param reqs[IN] the reads to issue. they are copied
+   * @param n[IN] the # of reads
+   * @param done[IN] the function to call on the I/O thread when all reads are done
+   * @param arg[IN] the argument to pass to done
+   */
+  static void readAsync(int fd, const IoRequest* reqs, int n, Callback done, void* arg);
+
+  /**
+   * turn the use of io_uring on or off. when it is off, or when the
+   * kernel does not support it, the reads go to the thread pool.
+   * the setting is initialized from the environment variable
+   * BRUINBASE_IO_URING, which is on unless it is set to 0.
+   * @param on[IN] true to use io_uring when it is available
+   */
+  static void setUring(bool on);
+
+  /**
+   * @return true if the reads of the calling thread go to an io_uring
+   */
+  static bool isUring();
+};
+
+#endif // IOBATCH_H
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "IoStats.h"
+#include <ctime>
+#include <map>
+#include <mutex>
+
+// the statistics of every file by name, and the names in the order the
+// files were first opened. the entries are never removed.
+static std::mutex                         registryLatch;
+static std::map<std::string, IoStats*>    registry;
+static std::vector<std::string>           registryOrder;
+
+IoStats::Counters::Counters()
+{
+  logicalReads = hits = misses = physicalReads = prefetches = 0;
+  writes = physicalWrites = evictions = bytesRead = bytesWritten = 0;
+  for (int b = 0; b < LATENCY_BUCKETS; b++) readLatency[b] = writeLatency[b] = 0;
+}
+
+IoStats::Counters& IoStats::Counters::operator+=(const Counters& c)
+{
+  logicalReads += c.logicalReads;
+  hits += c.hits;
+  misses += c.misses;
+  physicalReads += c.physicalReads;
+  prefetches += c.prefetches;
+  writes += c.writes;
+  physicalWrites += c.physicalWrites;
+  evictions += c.evictions;
+  bytesRead += c.bytesRead;
+  bytesWritten += c.bytesWritten;
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    readLatency[b] += c.readLatency[b];
+    writeLatency[b] += c.writeLatency[b];
+  }
+  return *this;
+}
+
+IoStats::Counters IoStats::Counters::operator-(const Counters& c) const
+{
+  Counters d = *this;
+
+  d.logicalReads -= c.logicalReads;
+  d.hits -= c.hits;
+  d.misses -= c.misses;
+  d.physicalReads -= c.physicalReads;
+  d.prefetches -= c.prefetches;
+  d.writes -= c.writes;
+  d.physicalWrites -= c.physicalWrites;
+  d.evictions -= c.evictions;
+  d.bytesRead -= c.bytesRead;
+  d.bytesWritten -= c.bytesWritten;
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    d.readLatency[b] -= c.readLatency[b];
+    d.writeLatency[b] -= c.writeLatency[b];
+  }
+  return d;
+}
+
+double IoStats::Counters::hitRatio() const
+{
+  if (hits + misses == 0) return -1;
+  return 100.0 * hits / (hits + misses);
+}
+
+long long IoStats::Counters::percentile(const long long* histogram, double pct)
+{
+  long long count = 0, seen = 0;
+
+  for (int b = 0; b < LATENCY_BUCKETS; b++) count += histogram[b];
+  if (count == 0) return 0;
+
+  // the first bucket that reaches the percentile
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += histogram[b];
+    if (seen * 100.0 >= pct * count) return 2LL << b;
+  }
+  return 2LL << (LATENCY_BUCKETS - 1);
+}
+
+IoStats::IoStats()
+{
+  logicalReads = hits = misses = physicalReads = prefetches = 0;
+  writes = physicalWrites = evictions = bytesRead = bytesWritten = 0;
+  for (int b = 0; b < LATENCY_BUCKETS; b++) readLatency[b] = writeLatency[b] = 0;
+}
+
+IoStats* IoStats::forFile(const std::string& filename)
+{
+  std::lock_guard<std::mutex> lock(registryLatch);
+
+  IoStats*& stats = registry[filename];
+  if (stats == NULL) {
+    stats = new IoStats();
+    registryOrder.push_back(filename);
+  }
+  return stats;
+}
+
+IoStats* IoStats::lookup(const std::string& filename)
+{
+  std::lock_guard<std::mutex> lock(registryLatch);
+
+  std::map<std::string, IoStats*>::iterator it = registry.find(filename);
+  return (it == registry.end()) ? NULL : it->second;
+}
+
+void IoStats::snapshotAll(std::vector<std::string>& names, std::vector<Counters>& counters)
+{
+  std::lock_guard<std::mutex> lock(registryLatch);
+
+  names = registryOrder;
+  counters.clear();
+  for (unsigned i = 0; i < names.size(); i++) {
+    counters.push_back(registry[names[i]]->snapshot());
+  }
+}
+
+IoStats::Counters IoStats::total()
+{
+  std::vector<std::string> names;
+  std::vector<Counters>    counters;
+  Counters sum;
+
+  snapshotAll(names, counters);
+  for (unsigned i = 0; i < counters.size(); i++) sum += counters[i];
+  return sum;
+}
+
+void IoStats::printHeader(FILE* out, const char* indent)
+{
+  fprintf(out, "%s%-16s %10s %10s %10s %7s %10s %10s %10s %10s %10s %10s %8s %8s\n",
+          indent, "file", "logical", "hits", "misses", "hit%", "phys_read", "prefetch",
+          "writes", "phys_write", "evicted", "kb_read", "rd_p50us", "rd_p99us");
+}
+
+void IoStats::print(FILE* out, const char* indent, const char* name, const Counters& c)
+{
+  char ratio[16];
+
+  if (c.hitRatio() < 0) snprintf(ratio, sizeof(ratio), "-");
+  else snprintf(ratio, sizeof(ratio), "%.1f", c.hitRatio());
+
+  fprintf(out, "%s%-16s %10lld %10lld %10lld %7s %10lld %10lld %10lld %10lld %10lld %10lld %8lld %8lld\n",
+          indent, name, c.logicalReads, c.hits, c.misses, ratio, c.physicalReads,
+          c.prefetches, c.writes, c.physicalWrites, c.evictions, c.bytesRead / 1024,
+          Counters::percentile(c.readLatency, 50), Counters::percentile(c.readLatency, 99));
+}
+
+IoStats::Counters IoStats::snapshot() const
+{
+  Counters c;
+
+  c.logicalReads = logicalReads;
+  c.hits = hits;
+  c.misses = misses;
+  c.physicalReads = physicalReads;
+  c.prefetches = prefetches;
+  c.writes = writes;
+  c.physicalWrites = physicalWrites;
+  c.evictions = evictions;
+  c.bytesRead = bytesRead;
+  c.bytesWritten = bytesWritten;
+  for (int b = 0; b < LATENCY_BUCKETS; b++) {
+    c.readLatency[b] = readLatency[b];
+    c.writeLatency[b] = writeLatency[b];
+  }
+  return c;
+}
+
+void IoStats::logicalRead(bool hit)
+{
+  logicalReads++;
+  if (hit) hits++;
+  else misses++;
+}
+
+void IoStats::physicalRead(int n, long long bytes, long long usec)
+{
+  physicalReads += n;
+  bytesRead += bytes;
+  readLatency[bucketOf(usec)]++;
+}
+
+void IoStats::physicalWrite(int n, long long bytes, long long usec)
+{
+  physicalWrites += n;
+  bytesWritten += bytes;
+  writeLatency[bucketOf(usec)]++;
+}
+
+long long IoStats::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int IoStats::bucketOf(long long usec)
+{
+  int b = 0;
+  while (b < LATENCY_BUCKETS - 1 && (2LL << b) <= usec) b++;
+  return b;
+}
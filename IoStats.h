@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef IOSTATS_H
+#define IOSTATS_H
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/**
+ * the I/O and cache statistics of a file.
+ * every PageFile opened on the same file name updates the same IoStats,
+ * so the counters accumulate over the lifetime of the process. the
+ * statistics of a single query are the difference between two snapshots
+ * taken before and after the query.
+ *
+ * a logical read is a request for a page by read(), readBatch() or pin().
+ * it is a hit if the page was found in the buffer pool, and a miss if it
+ * had to be read from the disk. the pages of a memory-mapped file are
+ * neither. a physical read is a page read from the disk, including the
+ * pages read ahead. likewise, a write is a call to write() and a physical
+ * write is a page written to the disk.
+ *
+ * the latency histograms count the disk operations by their duration.
+ * a batch of pages read at once is a single operation.
+ */
+class IoStats {
+ public:
+  // the # of buckets of a latency histogram. bucket 0 counts the
+  // operations shorter than 2 microseconds, bucket b > 0 the ones between
+  // 2^b and 2^(b+1) microseconds, and the last bucket the longer ones.
+  static const int LATENCY_BUCKETS = 24;
+
+  /**
+   * a snapshot of the counters
+   */
+  struct Counters {
+    long long logicalReads;   // # pages requested
+    long long hits;           // # pages requested and found in the pool
+    long long misses;         // # pages requested and read from the disk
+    long long physicalReads;  // # pages read from the disk
+    long long prefetches;     // # pages read ahead in the background
+    long long writes;         // # pages written by write()
+    long long physicalWrites; // # pages written to the disk
+    long long evictions;      // # pages evicted from the pool
+    long long bytesRead;      // # bytes read from the disk
+    long long bytesWritten;   // # bytes written to the disk
+    long long readLatency[LATENCY_BUCKETS];   // # reads by duration
+    long long writeLatency[LATENCY_BUCKETS];  // # writes by duration
+
+    Counters();
+    Counters& operator+=(const Counters& c);
+    Counters operator-(const Counters& c) const;
+
+    /**
+     * @return hits / (hits + misses) in percent. -1 if there was no request
+     */
+    double hitRatio() const;
+
+    /**
+     * estimate a percentile of the latency from a histogram.
+     * @param histogram[IN] readLatency or writeLatency
+     * @param pct[IN] the percentile between 0 and 100
+     * @return the upper bound of the bucket of the percentile in microseconds.
+     *         0 if the histogram is empty
+     */
+    static long long percentile(const long long* histogram, double pct);
+  };
+
+  /**
+   * @param filename[IN] the name the file is opened with
+   * @return the statistics of the file. the object lives until the
+   *         process exits, so the pointer stays valid.
+   */
+  static IoStats* forFile(const std::string& filename);
+
+  /**
+   * @param filename[IN] the name the file is opened with
+   * @return the statistics of the file. NULL if it has not been opened
+   */
+  static IoStats* lookup(const std::string& filename);
+
+  /**
+   * take a snapshot of the statistics of every file.
+   * the files are listed in the order they were first opened.
+   * @param names[OUT] the names of the files
+   * @param counters[OUT] the counters of each file
+   */
+  static void snapshotAll(std::vector<std::string>& names, std::vector<Counters>& counters);
+
+  /**
+   * @return the sum of the counters of every file
+   */
+  static Counters total();
+
+  /**
+   * print the header line of a table of counters.
+   * @param out[IN] the stream to print to
+   * @param indent[IN] the string printed at the beginning of the line
+   */
+  static void printHeader(FILE* out, const char* indent);
+
+  /**
+   * print the counters of a file as a line of the table.
+   * @param out[IN] the stream to print to
+   * @param indent[IN] the string printed at the beginning of the line
+   * @param name[IN] the name of the file
+   * @param c[IN] the counters to print
+   */
+  static void print(FILE* out, const char* indent, const char* name, const Counters& c);
+
+  /**
+   * @return a snapshot of the counters of the file
+   */
+  Counters snapshot() const;
+
+  //
+  // the following functions update the counters.
+  // they may be called by several threads at once.
+  //
+
+  // a page requested and found in the pool (hit) or not (miss)
+  void logicalRead(bool hit);
+
+  // a page requested in a memory-mapped file
+  void mappedRead() { logicalReads++; }
+
+  // n pages read from the disk by an operation of usec microseconds
+  void physicalRead(int n, long long bytes, long long usec);
+
+  // n pages read ahead in the background
+  void prefetched(int n) { prefetches += n; }
+
+  // a page written by write()
+  void logicalWrite() { writes++; }
+
+  // n pages written to the disk by an operation of usec microseconds
+  void physicalWrite(int n, long long bytes, long long usec);
+
+  // a page evicted from the pool
+  void evicted() { evictions++; }
+
+  /**
+   * @return the current time in microseconds, for timing an operation
+   */
+  static long long now();
+
+ private:
+  IoStats();
+
+  // the bucket of a latency
+  static int bucketOf(long long usec);
+
+  std::atomic<long long> logicalReads;
+  std::atomic<long long> hits;
+  std::atomic<long long> misses;
+  std::atomic<long long> physicalReads;
+  std::atomic<long long> prefetches;
+  std::atomic<long long> writes;
+  std::atomic<long long> physicalWrites;
+  std::atomic<long long> evictions;
+  std::atomic<long long> bytesRead;
+  std::atomic<long long> bytesWritten;
+  std::atomic<long long> readLatency[LATENCY_BUCKETS];
+  std::atomic<long long> writeLatency[LATENCY_BUCKETS];
+};
+
+#endif // IOSTATS_H
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "KeySorter.h"
+#include <algorithm>
+#include <cstdlib>
+
+// the size of the stdio buffer of a run
+static const size_t RUN_BUFFER_SIZE = 256 * 1024;
+
+int KeySorter::memoryMB = (getenv("BRUINBASE_SORT_MB") != NULL &&
+                           atoi(getenv("BRUINBASE_SORT_MB")) > 0) ?
+                          atoi(getenv("BRUINBASE_SORT_MB")) : DEFAULT_MEMORY_MB;
+
+bool KeySorter::Entry::operator<(const Entry& e) const
+{
+  if (key != e.key) return key < e.key;
+  return rid < e.rid;
+}
+
+KeySorter::KeySorter()
+{
+  maxEntries = (size_t) memoryMB * 1024 * 1024 / sizeof(Entry);
+  added = 0;
+  nextEntry = 0;
+  sorted = false;
+}
+
+KeySorter::~KeySorter()
+{
+  for (unsigned i = 0; i < runs.size(); i++) {
+    fclose(runs[i]->file);
+    delete runs[i];
+  }
+}
+
+RC KeySorter::setMemoryLimit(int mb)
+{
+  if (mb <= 0) return RC_INVALID_ATTRIBUTE;
+  memoryMB = mb;
+  return 0;
+}
+
+RC KeySorter::add(int key, const RecordId& rid)
+{
+  RC rc;
+  Entry e;
+
+  if (sorted) return RC_INVALID_FILE_MODE;
+  if (entries.size() >= maxEntries && (rc = spill()) < 0) return rc;
+
+  // grow the memory up to the limit, not beyond it
+  if (entries.size() == entries.capacity()) {
+    entries.reserve(std::min(maxEntries, std::max((size_t) 1024, 2 * entries.capacity())));
+  }
+
+  e.key = key;
+  e.rid = rid;
+  entries.push_back(e);
+  added++;
+  return 0;
+}
+
+RC KeySorter::spill()
+{
+  Run* run = new Run;
+
+  // tmpfile() removes the file when it is closed
+  if ((run->file = tmpfile()) == NULL) {
+    delete run;
+    return RC_FILE_OPEN_FAILED;
+  }
+  setvbuf(run->file, NULL, _IOFBF, RUN_BUFFER_SIZE);
+  runs.push_back(run);
+
+  std::sort(entries.begin(), entries.end());
+  if (fwrite(&entries[0], sizeof(Entry), entries.size(), run->file) != entries.size()) {
+    return RC_FILE_WRITE_FAILED;
+  }
+  entries.clear();
+  return 0;
+}
+
+RC KeySorter::sort()
+{
+  RC rc;
+
+  if (sorted) return 0;
+  sorted = true;
+
+  // everything fits in memory
+  if (runs.empty()) {
+    std::sort(entries.begin(), entries.end());
+    return 0;
+  }
+
+  // write the rest as the last run and merge all the runs
+  if (!entries.empty() && (rc = spill()) < 0) return rc;
+  std::vector<Entry>().swap(entries);
+
+  for (unsigned i = 0; i < runs.size(); i++) {
+    Run* run = runs[i];
+    if (fflush(run->file) != 0) return RC_FILE_WRITE_FAILED;
+    rewind(run->file);
+    if (fread(&run->head, sizeof(Entry), 1, run->file) == 1) heap.push_back(run);
+  }
+  std::make_heap(heap.begin(), heap.end(), RunAfter());
+  return 0;
+}
+
+RC KeySorter::next(int& key, RecordId& rid)
+{
+  if (!sorted) return RC_INVALID_FILE_MODE;
+
+  if (runs.empty()) {
+    if (nextEntry >= entries.size()) return RC_END_OF_TREE;
+    key = entries[nextEntry].key;
+    rid = entries[nextEntry].rid;
+    nextEntry++;
+    return 0;
+  }
+
+  if (heap.empty()) return RC_END_OF_TREE;
+
+  // take the head of the run with the smallest head, and put the run
+  // back with its next entry unless it is exhausted
+  std::pop_heap(heap.begin(), heap.end(), RunAfter());
+  Run* run = heap.back();
+  key = run->head.key;
+  rid = run->head.rid;
+  if (fread(&run->head, sizeof(Entry), 1, run->file) == 1) {
+    std::push_heap(heap.begin(), heap.end(), RunAfter());
+  } else {
+    if (ferror(run->file)) return RC_FILE_READ_FAILED;
+    heap.pop_back();
+  }
+  return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef KEYSORTER_H
+#define KEYSORTER_H
+
+#include "Bruinbase.h"
+#include "RecordFile.h"
+#include <cstdio>
+#include <vector>
+
+/**
+ * sorts (key, RecordId) pairs by key, and by RecordId among equal keys,
+ * for building an index bottom-up.
+ * the pairs are kept in memory up to the memory limit. when the limit is
+ * reached, the pairs in memory are sorted and written to a temporary file
+ * as a run. the runs are merged while the pairs are read back, so the
+ * pairs of any # of rows can be sorted in one pass over the runs.
+ */
+class KeySorter {
+ public:
+  // the memory limit in megabytes if BRUINBASE_SORT_MB is not set
+  static const int DEFAULT_MEMORY_MB = 64;
+
+  KeySorter();
+  ~KeySorter();
+
+  /**
+   * add a pair to sort. the pairs may be added in any order.
+   * @param key[IN] the key
+   * @param rid[IN] the RecordId of the tuple with the key
+   * @return error code. 0 if no error
+   */
+  RC add(int key, const RecordId& rid);
+
+  /**
+   * finish adding pairs and get ready to read them back in order.
+   * @return error code. 0 if no error
+   */
+  RC sort();
+
+  /**
+   * read the next pair in order. sort() must have been called.
+   * @param key[OUT] the key
+   * @param rid[OUT] the RecordId
+   * @return 0 if a pair was read. RC_END_OF_TREE after the last pair
+   */
+  RC next(int& key, RecordId& rid);
+
+  /**
+   * @return the # of pairs added
+   */
+  long long count() const { return added; }
+
+  /**
+   * @return the # of runs written to temporary files
+   */
+  int getRunCount() const { return (int) runs.size(); }
+
+  /**
+   * set the memory limit of the sorters created later. the setting is
+   * initialized from the environment variable BRUINBASE_SORT_MB, and is
+   * DEFAULT_MEMORY_MB otherwise.
+   * @param mb[IN] the memory limit in megabytes
+   * @return error code. 0 if no error
+   */
+  static RC setMemoryLimit(int mb);
+
+  /**
+   * @return the memory limit in megabytes
+   */
+  static int getMemoryLimit() { return memoryMB; }
+
+ private:
+  struct Entry {
+    int      key;
+    RecordId rid;
+
+    bool operator<(const Entry& e) const;
+  };
+
+  // a run on a temporary file, read one entry at a time while merging
+  struct Run {
+    FILE* file;
+    Entry head;   // the smallest entry of the run not yet returned
+  };
+
+  // sort the entries in memory and write them to a new run
+  RC spill();
+
+  // order the runs by their head, the smallest first
+  struct RunAfter {
+    bool operator()(const Run* a, const Run* b) const { return b->head < a->head; }
+  };
+
+  // the sorter holds temporary files, so it cannot be copied
+  KeySorter(const KeySorter&);
+  KeySorter& operator=(const KeySorter&);
+
+  static int memoryMB;
+
+  std::vector<Entry> entries;     // the entries in memory
+  size_t             maxEntries;  // the # of entries that fit in memory
+  long long          added;       // the # of entries added
+  size_t             nextEntry;   // the next entry in memory to return
+  std::vector<Run*>  runs;        // the runs on temporary files
+  std::vector<Run*>  heap;        // the runs that are not exhausted
+  bool               sorted;      // true once sort() has been called
+};
+
+#endif // KEYSORTER_H
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+//
+// microbenchmark for the B+tree nodes.
+// measures the cost of the node operations on a full, a half-full and
+// a nearly empty node. a full node has room for the one key inserted by
+// insert(). the nodes live in memory, so no page is read or written and
+// only the work inside the node is timed.
+//
+// every operation is repeated until it has run for at least MIN_NS in
+// total. insert() and insertAndSplit() change their node, so they are
+// timed over a batch of freshly filled nodes, one call per node.
+//
+// the key search inside the nodes can be chosen with BRUINBASE_KEY_SEARCH.
+//
+// usage: node_bench [page size]
+//
+
+#include "BTreeNode.h"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+
+// the minimum total time of an operation
+static const long long MIN_NS = 200000000;
+
+// the # of nodes modified by a timed batch of insert() or insertAndSplit()
+static const int BATCH = 64;
+
+// the # of keys of a nearly empty node
+static const int FEW_KEYS = 4;
+
+// the results of the lookups, so that the compiler cannot drop them
+static long long checksum = 0;
+
+static unsigned seed = 12345;
+static unsigned nextRandom()
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 1;
+}
+
+static long long nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// fill a leaf with the keys 2, 4, .., 2n, so that every odd key falls
+// between two keys of the node
+static void fillLeaf(BTLeafNode& node, int n)
+{
+  RecordId rid;
+  for (int i = 1; i <= n; i++) {
+    rid.pid = i;
+    rid.sid = 0;
+    node.insert(2 * i, rid);
+  }
+}
+
+// fill a non-leaf node with the keys 2, 4, .., 2n
+static void fillNonLeaf(BTNonLeafNode& node, int n)
+{
+  node.initializeRoot(0, 1, 2, 1, 1);
+  for (int i = 2; i <= n; i++) node.insert(2 * i, i, 1);
+}
+
+static void print(const char* op, const char* fill, int keys, double ns)
+{
+  printf("%-22s %8s %6d %12.1f\n", op, fill, keys, ns);
+}
+
+static double benchLeafInsert(int pageSize, int n)
+{
+  long long total = 0, ops = 0;
+  std::vector<BTLeafNode*> nodes(BATCH);
+  std::vector<int> keys(BATCH);
+  RecordId rid = { 1, 0 };
+
+  while (total < MIN_NS) {
+    for (int b = 0; b < BATCH; b++) {
+      nodes[b] = new BTLeafNode(pageSize);
+      fillLeaf(*nodes[b], n);
+      keys[b] = 2 * (int) (nextRandom() % (n + 1)) + 1;
+    }
+    long long begin = nowNs();
+    for (int b = 0; b < BATCH; b++) nodes[b]->insert(keys[b], rid);
+    total += nowNs() - begin;
+    ops += BATCH;
+    for (int b = 0; b < BATCH; b++) delete nodes[b];
+  }
+  return (double) total / ops;
+}
+
+static double benchLeafSplit(int pageSize, int n)
+{
+  long long total = 0, ops = 0;
+  std::vector<BTLeafNode*> nodes(BATCH), siblings(BATCH);
+  std::vector<int> keys(BATCH);
+  RecordId rid = { 1, 0 };
+  int siblingKey;
+
+  while (total < MIN_NS) {
+    for (int b = 0; b < BATCH; b++) {
+      nodes[b] = new BTLeafNode(pageSize);
+      siblings[b] = new BTLeafNode(pageSize);
+      fillLeaf(*nodes[b], n);
+      keys[b] = 2 * (int) (nextRandom() % (n + 1)) + 1;
+    }
+    long long begin = nowNs();
+    for (int b = 0; b < BATCH; b++) nodes[b]->insertAndSplit(keys[b], rid, *siblings[b], siblingKey);
+    total += nowNs() - begin;
+    ops += BATCH;
+    for (int b = 0; b < BATCH; b++) {
+      delete nodes[b];
+      delete siblings[b];
+    }
+  }
+  return (double) total / ops;
+}
+
+static double benchLeafLocate(int pageSize, int n)
+{
+  long long total = 0, ops = 0;
+  BTLeafNode node(pageSize);
+  std::vector<int> keys(1024);
+  int eid;
+
+  fillLeaf(node, n);
+  for (unsigned i = 0; i < keys.size(); i++) keys[i] = (int) (nextRandom() % (2 * n + 2));
+  while (total < MIN_NS) {
+    long long begin = nowNs();
+    for (unsigned i = 0; i < keys.size(); i++) {
+      node.locate(keys[i], eid);
+      checksum += eid;
+    }
+    total += nowNs() - begin;
+    ops += keys.size();
+  }
+  return (double) total / ops;
+}
+
+static double benchLeafKeyCount(int pageSize, int n)
+{
+  long long total = 0, ops = 0;
+  BTLeafNode node(pageSize);
+
+  fillLeaf(node, n);
+  while (total < MIN_NS) {
+    long long begin = nowNs();
+    for (int i = 0; i < 1024; i++) checksum += node.getKeyCount();
+    total += nowNs() - begin;
+    ops += 1024;
+  }
+  return (double) total / ops;
+}
+
+static double benchLocateChildPtr(int pageSize, int n)
+{
+  long long total = 0, ops = 0;
+  BTNonLeafNode node(pageSize);
+  std::vector<int> keys(1024);
+  PageId pid;
+
+  fillNonLeaf(node, n);
+  for (unsigned i = 0; i < keys.size(); i++) keys[i] = (int) (nextRandom() % (2 * n + 2));
+  while (total < MIN_NS) {
+    long long begin = nowNs();
+    for (unsigned i = 0; i < keys.size(); i++) {
+      node.locateChildPtr(keys[i], pid);
+      checksum += pid;
+    }
+    total += nowNs() - begin;
+    ops += keys.size();
+  }
+  return (double) total / ops;
+}
+
+int main(int argc, char* argv[])
+{
+  static const char* fills[] = { "full", "half", "few" };
+  int pageSize = (argc > 1) ? atoi(argv[1]) : PageFile::DEFAULT_PAGE_SIZE;
+
+  if (!PageFile::isValidPageSize(pageSize)) {
+    fprintf(stderr, "Error: invalid page size %s\n", argv[1]);
+    return 1;
+  }
+
+  BTLeafNode    leaf(pageSize);
+  BTNonLeafNode nonLeaf(pageSize);
+  int leafMax = leaf.getMaxKeyCount();
+  int nonLeafMax = nonLeaf.getMaxKeyCount();
+
+  printf("%-22s %8s %6s %12s\n", "op", "fill", "keys", "ns_per_op");
+  for (int f = 0; f < 3; f++) {
+    int leafKeys = (f == 0) ? leafMax - 1 : (f == 1) ? leafMax / 2 : FEW_KEYS;
+    int nonLeafKeys = (f == 0) ? nonLeafMax - 1 : (f == 1) ? nonLeafMax / 2 : FEW_KEYS;
+
+    print("leaf.insert", fills[f], leafKeys, benchLeafInsert(pageSize, leafKeys));
+    print("leaf.insertAndSplit", fills[f], leafKeys, benchLeafSplit(pageSize, leafKeys));
+    print("leaf.locate", fills[f], leafKeys, benchLeafLocate(pageSize, leafKeys));
+    print("leaf.getKeyCount", fills[f], leafKeys, benchLeafKeyCount(pageSize, leafKeys));
+    print("nonleaf.locateChildPtr", fills[f], nonLeafKeys, benchLocateChildPtr(pageSize, nonLeafKeys));
+  }
+
+  fprintf(stderr, "key search %s, checksum %lld\n", getKeySearchName(), checksum);
+  return 0;
+}
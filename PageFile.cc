@@ -9,31 +9,95 @@
 
 #include "Bruinbase.h"
 #include "PageFile.h"
+#include "BufferPool.h"
+#include "IoBatch.h"
+#include "IoStats.h"
+#include <condition_variable>
+#include <cstdlib>
 #include <cstring>
+#include <mutex>
+#include <vector>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 using std::string;
 
-int PageFile::readCount = 0;
-int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
+int PageFile::readAheadPages = (getenv("BRUINBASE_READ_AHEAD") != NULL) ?
+                               atoi(getenv("BRUINBASE_READ_AHEAD")) : DEFAULT_READ_AHEAD;
+
+// the # of ascending pins in a row after which a file is read ahead
+static const int READ_AHEAD_TRIGGER = 2;
+
+// signaled when a prefetch batch is done, so that close() can wait for it
+static std::mutex              prefetchLatch;
+static std::condition_variable prefetchDone;
+
+// a batch of pages being read ahead
+struct PageFile::Prefetch {
+  const PageFile*     file;
+  std::vector<PageId> pids;
+  long long           start;  // the time the batch was queued
+};
+bool PageFile::memoryMapped = (getenv("BRUINBASE_MMAP") != NULL &&
+                               atoi(getenv("BRUINBASE_MMAP")) != 0);
+int PageFile::defaultPageSize = (getenv("BRUINBASE_PAGE_SIZE") != NULL &&
+                                 isValidPageSize(atoi(getenv("BRUINBASE_PAGE_SIZE")))) ?
+                                atoi(getenv("BRUINBASE_PAGE_SIZE")) : DEFAULT_PAGE_SIZE;
+
+// the header at the beginning of a file. the rest of the first
+// page-sized block of the file is left empty.
+struct FileHeader {
+  char magic[8];    // HEADER_MAGIC
+  int  pageSize;    // the page size of the file
+};
+
+static const char HEADER_MAGIC[8] = { 'B', 'R', 'U', 'I', 'N', 'P', 'F', '1' };
 
 PageFile::PageFile() 
 { 
   fd = -1; 
   epid = 0; 
+  fid = -1;
+  readOnly = false;
+  pageSize = defaultPageSize;
+  base = 0;
+  map = NULL;
+  mapSize = 0;
+  stats = NULL;
+  lastPid = -1;
+  seqRun = 0;
+  raEnd = 0;
+  hint = NORMAL;
+  pending = 0;
 }
 
 PageFile::PageFile(const string& filename, char mode)
 {
   fd = -1;
   epid = 0;
+  fid = -1;
+  readOnly = false;
+  pageSize = defaultPageSize;
+  base = 0;
+  map = NULL;
+  mapSize = 0;
+  stats = NULL;
+  lastPid = -1;
+  seqRun = 0;
+  raEnd = 0;
+  hint = NORMAL;
+  pending = 0;
   open(filename.c_str(), mode);
 }
 
+PageFile::~PageFile()
+{
+  std::unique_lock<std::mutex> lock(prefetchLatch);
+  while (pending > 0) prefetchDone.wait(lock);
+}
+
 RC PageFile::open(const string& filename, char mode)
 {
   RC   rc;
@@ -63,118 +127,510 @@ RC PageFile::open(const string& filename, char mode)
   // get the size of the file to set the end pid
   rc = ::fstat(fd, &statbuf);
   if (rc < 0) { ::close(fd); fd = -1; return RC_FILE_OPEN_FAILED; }
-  epid = statbuf.st_size / PAGE_SIZE;
+
+  // get the page size from the header. a new file gets a header.
+  readOnly = (oflag == O_RDONLY);
+  if ((rc = readHeader(statbuf.st_size)) < 0 || ::fstat(fd, &statbuf) < 0) {
+    ::close(fd);
+    fd = -1;
+    return (rc < 0) ? rc : RC_FILE_OPEN_FAILED;
+  }
+  epid = (statbuf.st_size > base) ? (statbuf.st_size - base) / pageSize : 0;
+  lastPid = -1;
+  seqRun = 0;
+  raEnd = 0;
+  hint = NORMAL;
+
+  // register the file with the buffer pool
+  stats = IoStats::forFile(filename);
+  fid = BufferPool::getInstance().openFile(statbuf, readOnly ? -1 : fd, pageSize, base, stats);
+
+  // in memory-mapped mode, map a read-only file into memory.
+  // if the mapping fails, the pages are read through the buffer pool.
+  if (readOnly && memoryMapped && epid > 0) {
+    mapSize = base + (size_t) epid * pageSize;
+    map = (char*) ::mmap(NULL, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+      map = NULL;
+      mapSize = 0;
+    }
+  }
 
   return 0;
 }
 
+RC PageFile::readHeader(off_t size)
+{
+  FileHeader header;
+
+  // an empty file opened for writing is new. it gets the default page size.
+  if (size == 0) {
+    pageSize = defaultPageSize;
+    base = 0;
+    if (readOnly) return 0;
+
+    char block[MAX_PAGE_SIZE];
+    memset(block, 0, pageSize);
+    memcpy(header.magic, HEADER_MAGIC, sizeof(header.magic));
+    header.pageSize = pageSize;
+    memcpy(block, &header, sizeof(header));
+    if (::pwrite(fd, block, pageSize, 0) != pageSize) return RC_FILE_WRITE_FAILED;
+    base = pageSize;
+    return 0;
+  }
+
+  // a file without the header has the legacy page size
+  if (::pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+      memcmp(header.magic, HEADER_MAGIC, sizeof(header.magic)) != 0) {
+    pageSize = LEGACY_PAGE_SIZE;
+    base = 0;
+    return 0;
+  }
+
+  if (!isValidPageSize(header.pageSize)) return RC_INVALID_FILE_FORMAT;
+  pageSize = header.pageSize;
+  base = pageSize;
+  return 0;
+}
+
 RC PageFile::close()
 {
+  RC   rc;
+  struct stat statbuf;
+
   if (fd <= 0) return RC_FILE_CLOSE_FAILED;
 
-  // close the file
-  if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
+  // the pages being read ahead need the file descriptor
+  {
+    std::unique_lock<std::mutex> lock(prefetchLatch);
+    while (pending > 0) prefetchDone.wait(lock);
+  }
 
-  // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-    }
+  // write the dirty pages of the file to the disk
+  if ((rc = flush()) < 0) return rc;
+
+  // unmap the file
+  if (map != NULL) {
+    ::munmap(map, mapSize);
+    map = NULL;
+    mapSize = 0;
   }
 
+  // remember the state of the file so that its cached pages
+  // can be used again when the file is reopened
+  if (::fstat(fd, &statbuf) < 0) return RC_FILE_CLOSE_FAILED;
+  BufferPool::getInstance().closeFile(fid, fd, statbuf);
+
+  // close the file
+  if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
+
   // set the fd and epid to the initial state
   fd = -1; 
   epid = 0;
+  fid = -1;
   return 0;
 }
 
-PageId PageFile::endPid() const 
+RC PageFile::flush()
 {
-  return epid;
+  if (fd <= 0) return RC_FILE_WRITE_FAILED;
+
+  return BufferPool::getInstance().flushFile(fid);
+}
+
+RC PageFile::advise(Access pattern) const
+{
+  int advice;
+
+  if (fd <= 0) return RC_FILE_OPEN_FAILED;
+  hint = pattern;
+
+  // the hint is only advisory. an error in giving it is not reported.
+  if (map != NULL) {
+    switch (pattern) {
+    case SEQUENTIAL: advice = MADV_SEQUENTIAL; break;
+    case RANDOM:     advice = MADV_RANDOM;     break;
+    default:         advice = MADV_NORMAL;     break;
+    }
+    ::madvise(map, mapSize, advice);
+  } else {
+    switch (pattern) {
+    case SEQUENTIAL: advice = POSIX_FADV_SEQUENTIAL; break;
+    case RANDOM:     advice = POSIX_FADV_RANDOM;     break;
+    default:         advice = POSIX_FADV_NORMAL;     break;
+    }
+    ::posix_fadvise(fd, 0, 0, advice);
+  }
+
+  return 0;
+}
+
+RC PageFile::setDefaultPageSize(int size)
+{
+  if (!isValidPageSize(size)) return RC_INVALID_ATTRIBUTE;
+  defaultPageSize = size;
+  return 0;
 }
 
-RC PageFile::seek(PageId pid) const
+bool PageFile::isValidPageSize(int size)
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
+  // a power of two within the range
+  return size >= MIN_PAGE_SIZE && size <= MAX_PAGE_SIZE && (size & (size - 1)) == 0;
+}
+
+long long PageFile::getPageReadCount()
+{
+  return IoStats::total().physicalReads;
+}
+
+long long PageFile::getPageWriteCount()
+{
+  return IoStats::total().writes;
+}
+
+PageId PageFile::endPid() const 
+{
+  return epid;
 }
 
 RC PageFile::write(PageId pid, const void* buffer)
 {
-  RC rc;
-  if (pid < 0) return RC_INVALID_PID; 
+  char*  frame;
+  bool   valid;
+  PageId end;
+  BufferPool& pool = BufferPool::getInstance();
 
-  // seek to the location of the page
-  if ((rc = seek(pid)) < 0) return rc;
+  if (pid < 0) return RC_INVALID_PID; 
+  if (fd <= 0 || readOnly) return RC_FILE_WRITE_FAILED;
 
-  // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
+  // in write-back mode, the page is only updated in the buffer pool.
+  // when the caller modified a pinned frame in place, there is nothing to copy.
+  if (pool.isWriteBack() && pool.pin(fid, pid, frame, valid) == 0) {
+    if (frame != buffer) memcpy(frame, buffer, pageSize);
+    if (!valid) pool.loaded(fid, pid, true);
+    pool.markDirty(fid, pid);
+    pool.unpin(fid, pid);
+  } else {
+    // write the buffer to the disk page
+    long long start = IoStats::now();
+    if (::pwrite(fd, buffer, pageSize, base + (off_t) pid * pageSize) != pageSize) {
+      return RC_FILE_WRITE_FAILED;
+    }
+    stats->physicalWrite(1, pageSize, IoStats::now() - start);
 
-  // if the page is in read cache, invalidate it
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-       break;
+    // keep a copy of the written page in the buffer pool
+    if (pool.pin(fid, pid, frame, valid) == 0) {
+      if (frame != buffer) memcpy(frame, buffer, pageSize);
+      if (!valid) pool.loaded(fid, pid, true);
+      pool.unpin(fid, pid);
     }
   }
 
   // if the written pid >= end pid, update the end pid
-  if (pid >= epid) epid = pid + 1;
+  end = epid;
+  while (pid >= end && !epid.compare_exchange_weak(end, pid + 1)) ;
 
   // increase page write count
-  writeCount++;
+  stats->logicalWrite();
 
   return 0;
 }
 
 RC PageFile::read(PageId pid, void* buffer) const
 {
-  RC rc;
+  RC    rc;
+  char* frame;
 
-  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+  // a memory-mapped page is copied from the mapping
+  if (map != NULL) {
+    if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+    memcpy(buffer, map + base + (size_t) pid * pageSize, pageSize);
+    stats->mappedRead();
+    return 0;
+  }
+
+  // pin the page in the buffer pool and copy it to the buffer.
+  // if every frame is pinned, read the page around the pool.
+  if ((rc = pin(pid, frame)) == RC_BUFFER_POOL_FULL) {
+    long long start = IoStats::now();
+    if (::pread(fd, buffer, pageSize, base + (off_t) pid * pageSize) != pageSize) {
+      return RC_FILE_READ_FAILED;
+    }
+    stats->logicalRead(false);
+    stats->physicalRead(1, pageSize, IoStats::now() - start);
+    return 0;
+  }
+  if (rc < 0) return rc;
+  memcpy(buffer, frame, pageSize);
 
-  //
-  // if the page is in cache, read it from there
-  //
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
+  return unpin(pid);
+}
+
+RC PageFile::readBatch(const PageId* pids, int n, void* const* buffers) const
+{
+  RC rc = 0;
+  BufferPool& pool = BufferPool::getInstance();
+
+  for (int i = 0; i < n; i++) {
+    if (pids[i] < 0 || pids[i] >= epid) return RC_INVALID_PID;
+  }
+
+  // memory-mapped pages are copied from the mapping, and need no loading
+  if (map != NULL) {
+    for (int i = 0; buffers != NULL && i < n; i++) {
+      memcpy(buffers[i], map + base + (size_t) pids[i] * pageSize, pageSize);
+      stats->mappedRead();
     }
+    return 0;
   }
 
-  // seek to the page
-  if ((rc = seek(pid)) < 0) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
+  // a batch pins all of its pages at once. keep it to a small part of
+  // the pool so that concurrent batches do not pin every frame.
+  int depth = pool.getFrameCount(pageSize) / 8;
+  if (depth > IoBatch::QUEUE_DEPTH) depth = IoBatch::QUEUE_DEPTH;
+  if (depth < 1) depth = 1;
+
+  for (int start = 0; start < n; start += depth) {
+    IoRequest reqs[IoBatch::QUEUE_DEPTH];
+    int       owner[IoBatch::QUEUE_DEPTH];     // the page of each read
+    bool      inFrame[IoBatch::QUEUE_DEPTH];   // true if read into a frame
+    int       deferred[IoBatch::QUEUE_DEPTH];  // pages read by someone else
+    int       nreqs = 0, ndeferred = 0;
+    int       end = (n - start < depth) ? n : start + depth;
+
+    for (int i = start; i < end; i++) {
+      char* frame;
+      bool  valid;
+
+      // a page being read by another thread, or listed twice in the
+      // batch, is read after our own reads are done. waiting for it now
+      // could deadlock against a thread waiting for one of our pages.
+      // without buffers, the other thread loads the page for us.
+      RC prc = pool.pin(fid, pids[i], frame, valid, false);
+      if (prc == RC_PAGE_BUSY) {
+        if (buffers != NULL) deferred[ndeferred++] = i;
+        continue;
+      }
+
+      // a cached page is copied right away
+      if (prc == 0 && valid) {
+        if (buffers != NULL) {
+          memcpy(buffers[i], frame, pageSize);
+          stats->logicalRead(true);
+        }
+        pool.unpin(fid, pids[i]);
+        continue;
+      }
+
+      // without buffers, a page that has no frame is left to be read later
+      if (prc != 0 && buffers == NULL) continue;
+
+      // otherwise the page is read into its frame, or straight into the
+      // buffer if the pool has no frame to spare
+      reqs[nreqs].offset = base + (off_t) pids[i] * pageSize;
+      reqs[nreqs].buffer = (prc == 0) ? frame : (char*) buffers[i];
+      reqs[nreqs].length = pageSize;
+      owner[nreqs] = i;
+      inFrame[nreqs] = (prc == 0);
+      nreqs++;
     }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
+
+    long long begin = IoStats::now();
+    IoBatch::read(fd, reqs, nreqs);
+    long long elapsed = IoStats::now() - begin;
+    int       nread = 0;
+
+    for (int j = 0; j < nreqs; j++) {
+      PageId pid = pids[owner[j]];
+      bool   ok = (reqs[j].result == pageSize);
+
+      if (inFrame[j]) {
+        pool.loaded(fid, pid, ok);
+        if (ok) {
+          if (buffers != NULL) memcpy(buffers[owner[j]], reqs[j].buffer, pageSize);
+          pool.unpin(fid, pid);
+        }
+      }
+      if (ok) nread++;
+      else rc = RC_FILE_READ_FAILED;
+    }
+    if (nreqs > 0) stats->physicalRead(nread, (long long) nread * pageSize, elapsed);
+
+    // pages only loaded into the pool are counted like the pages read
+    // ahead. the logical reads are counted when the pages are pinned.
+    if (buffers != NULL) {
+      for (int j = 0; j < nread; j++) stats->logicalRead(false);
+    } else {
+      stats->prefetched(nread);
+    }
+
+    for (int j = 0; j < ndeferred; j++) {
+      RC drc = read(pids[deferred[j]], buffers[deferred[j]]);
+      if (drc < 0) rc = drc;
     }
   }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
- 
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
+
+  return rc;
+}
+
+RC PageFile::pin(PageId pid, char*& page) const
+{
+  RC   rc;
+  bool valid;
+  BufferPool& pool = BufferPool::getInstance();
+
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+
+  // a memory-mapped page is used in place. the mapping is read-only,
+  // so the page must not be modified.
+  if (map != NULL) {
+    page = map + base + (size_t) pid * pageSize;
+    stats->mappedRead();
+    return 0;
+  }
+
+  // start reading the following pages if the file is read sequentially
+  readAhead(pid);
+
+  // if the page is in the buffer pool, use it from there
+  if ((rc = pool.pin(fid, pid, page, valid)) < 0) return rc;
+  if (valid) {
+    stats->logicalRead(true);
+    return 0;
+  }
+
+  // otherwise read the page from the disk into the frame. the frame may
+  // still hold another page, so a short read must not make it valid.
+  long long start = IoStats::now();
+  if (::pread(fd, page, pageSize, base + (off_t) pid * pageSize) != pageSize) {
+    pool.loaded(fid, pid, false);
     return RC_FILE_READ_FAILED;
   }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
+  pool.loaded(fid, pid, true);
 
   // increase the page read count
-  readCount++;
+  stats->logicalRead(false);
+  stats->physicalRead(1, pageSize, IoStats::now() - start);
+
+  return 0;
+}
+
+RC PageFile::unpin(PageId pid) const
+{
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
 
+  // memory-mapped pages are not pinned
+  if (map == NULL) BufferPool::getInstance().unpin(fid, pid);
   return 0;
 }
+
+void PageFile::readAhead(PageId pid) const
+{
+  int window = readAheadPages;
+
+  // prefetch() pins no more than a small part of the pool at once
+  int cap = BufferPool::getInstance().getFrameCount(pageSize) / 8;
+  if (window > cap) window = cap;
+
+  if (window <= 0 || hint == RANDOM) return;
+
+  // a page is usually pinned several times in a row, once per record
+  PageId last = lastPid.exchange(pid);
+  if (pid == last) return;
+
+  // wait for a few ascending pins in a row, unless the scan was announced
+  if (hint != SEQUENTIAL) {
+    if (pid != last + 1) {
+      seqRun = 0;
+      return;
+    }
+    if (++seqRun < READ_AHEAD_TRIGGER) return;
+  }
+
+  // keep up to a window of pages ahead of pid in the pool. a new batch is
+  // issued once half of the window has been consumed, so that the reads
+  // go out in large batches.
+  PageId end = raEnd;
+  PageId first = (end > pid) ? end : pid + 1;
+  PageId limit = (pid + 1 + window < epid) ? pid + 1 + window : (PageId) epid;
+  if (first >= limit) return;
+  if (limit - first < (window + 1) / 2 && limit < epid) return;
+
+  // another thread scanning the file may have claimed the pages.
+  // the pages prefetch() could not cover are left to the next call.
+  if (!raEnd.compare_exchange_strong(end, limit)) return;
+  PageId covered = first + prefetch(first, limit - first);
+  if (covered < limit) raEnd.compare_exchange_strong(limit, covered);
+}
+
+int PageFile::prefetch(PageId first, int n) const
+{
+  BufferPool& pool = BufferPool::getInstance();
+  std::vector<IoRequest> reqs;
+  Prefetch* batch = new Prefetch;
+
+  // the pages stay pinned until they are read. keep them to a small
+  // part of the pool, as readBatch() does.
+  int limit = pool.getFrameCount(pageSize) / 8;
+  if (n > limit) n = limit;
+
+  batch->file = this;
+  batch->start = IoStats::now();
+  PageId pid;
+  for (pid = first; pid < first + n; pid++) {
+    char* frame;
+    bool  valid;
+
+    // skip the pages that are cached or being read by somebody else
+    RC rc = pool.pin(fid, pid, frame, valid, false);
+    if (rc == RC_PAGE_BUSY) continue;
+    if (rc < 0) break;
+    if (valid) {
+      pool.unpin(fid, pid);
+      continue;
+    }
+
+    IoRequest req;
+    req.offset = base + (off_t) pid * pageSize;
+    req.buffer = frame;
+    req.length = pageSize;
+    req.result = 0;
+    reqs.push_back(req);
+    batch->pids.push_back(pid);
+  }
+
+  if (reqs.empty()) {
+    delete batch;
+    return pid - first;
+  }
+
+  pending++;
+  IoBatch::readAsync(fd, reqs.data(), (int) reqs.size(), prefetched, batch);
+  return pid - first;
+}
+
+void PageFile::prefetched(void* arg, IoRequest* reqs, int n)
+{
+  Prefetch* batch = (Prefetch*) arg;
+  const PageFile* file = batch->file;
+  BufferPool& pool = BufferPool::getInstance();
+
+  // hand the pages over to the threads waiting for them
+  int nread = 0;
+  for (int i = 0; i < n; i++) {
+    bool ok = (reqs[i].result == file->pageSize);
+    pool.loaded(file->fid, batch->pids[i], ok);
+    if (ok) {
+      pool.unpin(file->fid, batch->pids[i]);
+      nread++;
+    }
+  }
+  file->stats->physicalRead(nread, (long long) nread * file->pageSize,
+                            IoStats::now() - batch->start);
+  file->stats->prefetched(nread);
+  delete batch;
+
+  std::lock_guard<std::mutex> lock(prefetchLatch);
+  file->pending--;
+  prefetchDone.notify_all();
+}
@@ -10,22 +10,62 @@
 #ifndef PAGEFILE_H
 #define PAGEFILE_H
 
+#include <atomic>
 #include <string>
+#include <sys/types.h>
 #include "Bruinbase.h"
 
 typedef int PageId;
 
+struct IoRequest;
+class IoStats;
+
 /**
- * read/write a file in the unit of a page
+ * read/write a file in the unit of a page.
+ * the pages of the file are cached in the shared BufferPool. when the
+ * pool is in write-back mode, write() only updates the cached page and
+ * the page reaches the disk when it is flushed.
+ * pages are accessed with positional I/O, so a PageFile has no file
+ * cursor and its pages may be read by several threads at once.
+ * in memory-mapped mode, a file opened in 'r' mode is mapped into memory
+ * and its pages are accessed in the mapping, bypassing the buffer pool.
+ *
+ * the page size of a file is chosen when the file is created and is
+ * recorded in a header that occupies the first page-sized block of the
+ * file, so page 0 starts right after the header. a file without the
+ * header was created before page sizes were configurable and has
+ * LEGACY_PAGE_SIZE pages.
+ *
+ * when the pages of a file are pinned in ascending order, the pages
+ * ahead of the last one are read into the buffer pool in the background
+ * (read-ahead), so that a sequential scan rarely waits for the disk.
+ *
+ * the page requests and the disk I/O of a file are counted in the
+ * IoStats of its file name.
  */
 class PageFile {
  public:
 
-  static const int PAGE_SIZE = 1024;    // the size of a page is 1KB
+  static const int LEGACY_PAGE_SIZE  = 1024;   // page size of a file without header
+  static const int MIN_PAGE_SIZE     = 1024;   // the smallest page size
+  static const int MAX_PAGE_SIZE     = 16384;  // the largest page size
+  static const int DEFAULT_PAGE_SIZE = 4096;  // default page size of a new file
+  static const int DEFAULT_READ_AHEAD = 32;   // default read-ahead window in pages
+
+  /**
+   * the expected access pattern of a file, given to advise()
+   */
+  enum Access { NORMAL, SEQUENTIAL, RANDOM };
 
   PageFile();
   PageFile(const std::string& filename, char mode);
 
+  /**
+   * wait for the pages of the file being read ahead.
+   * the file is not closed.
+   */
+  ~PageFile();
+
   /**
    * open a file in read or write mode.
    * when opened in 'w' mode, if the file does not exist, it is created.
@@ -36,10 +76,76 @@ class PageFile {
   RC open(const std::string& filename, char mode);
 
   /**
-   * close the file.
+   * close the file. the dirty pages of the file are flushed first.
    * @return error code. 0 if no error
    */
   RC close();
+
+  /**
+   * write the dirty pages of the file to the disk.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * tell the operating system how the file is going to be accessed,
+   * so that it can read ahead or not. the hint is given with madvise()
+   * for a memory-mapped file and with posix_fadvise() otherwise.
+   * the read-ahead of the buffer pool starts with the first page pinned
+   * after SEQUENTIAL, and is turned off by RANDOM.
+   * @param pattern[IN] the expected access pattern
+   * @return error code. 0 if no error
+   */
+  RC advise(Access pattern) const;
+
+  /**
+   * turn the memory-mapped mode on or off for the files opened later.
+   * the mode is initialized from the environment variable BRUINBASE_MMAP.
+   * @param on[IN] true to map files opened in 'r' mode into memory
+   */
+  static void setMemoryMapped(bool on) { memoryMapped = on; }
+
+  /**
+   * @return true if the files opened in 'r' mode are mapped into memory
+   */
+  static bool isMemoryMapped() { return memoryMapped; }
+
+  /**
+   * set the page size of the files created later. the page size must be
+   * a power of two between MIN_PAGE_SIZE and MAX_PAGE_SIZE. the setting
+   * is initialized from the environment variable BRUINBASE_PAGE_SIZE.
+   * @param size[IN] the page size in bytes
+   * @return error code. 0 if no error
+   */
+  static RC setDefaultPageSize(int size);
+
+  /**
+   * @return the page size of the files created later
+   */
+  static int getDefaultPageSize() { return defaultPageSize; }
+
+  /**
+   * @return true if size is a valid page size
+   */
+  static bool isValidPageSize(int size);
+
+  /**
+   * set the # of pages to read ahead of a sequential scan. 0 turns the
+   * read-ahead off. the setting is initialized from the environment
+   * variable BRUINBASE_READ_AHEAD, and is DEFAULT_READ_AHEAD otherwise.
+   * @param pages[IN] the size of the read-ahead window in pages
+   */
+  static void setReadAhead(int pages) { readAheadPages = (pages < 0) ? 0 : pages; }
+
+  /**
+   * @return the # of pages to read ahead of a sequential scan
+   */
+  static int getReadAhead() { return readAheadPages; }
+
+  /**
+   * @return the page size of the file in bytes
+   */
+  int getPageSize() const { return pageSize; }
   
   /**
    * read a disk page into memory buffer.
@@ -48,6 +154,40 @@ class PageFile {
    * @return error code. 0 if no error
    */
   RC read(PageId pid, void *buffer) const;
+
+  /**
+   * read many disk pages into memory buffers at once.
+   * the pages that are not in the buffer pool are read from the disk
+   * in batches of IoBatch::QUEUE_DEPTH concurrent reads.
+   * if buffers is NULL, the pages are only read into the buffer pool,
+   * so that they can be pinned afterwards without waiting for the disk.
+   * @param pids[IN] the pages to read
+   * @param n[IN] the # of pages to read
+   * @param buffers[OUT] pointers to the memory buffers, one per page, or NULL
+   * @return error code. 0 if no error
+   */
+  RC readBatch(const PageId* pids, int n, void* const* buffers) const;
+
+  /**
+   * pin a disk page in the buffer pool and return a pointer to the frame
+   * that caches it, so that the page can be accessed without a copy.
+   * the page is not evicted while it is pinned. every successful pin()
+   * must be matched by an unpin() on the same page.
+   * the frame may be modified in place, as long as it is written back
+   * by calling write() with the frame as the buffer.
+   * @param pid[IN] the page to pin
+   * @param page[OUT] pointer to the frame that caches the page
+   * @return error code. 0 if no error
+   */
+  RC pin(PageId pid, char*& page) const;
+
+  /**
+   * release a pin obtained by pin().
+   * the frame pointer returned by pin() must not be used afterwards.
+   * @param pid[IN] the page to unpin
+   * @return error code. 0 if no error
+   */
+  RC unpin(PageId pid) const;
   
   /**
    * write the memory buffer to the disk page.
@@ -66,47 +206,61 @@ class PageFile {
    */
   PageId endPid() const;
 
+  /**
+   * @return the I/O and cache statistics of the file. NULL if the file
+   *         has never been opened
+   */
+  IoStats* getStats() const { return stats; }
+
   /**
    * @return the total # of disk reads
    */
-  static int getPageReadCount()  { return readCount; }
+  static long long getPageReadCount();
   
   /**
-   * @return the total # of disk writes
+   * @return the total # of page writes
    */
-  static int getPageWriteCount() { return writeCount; }
-
- protected:
-  /**
-   * move the file cursor to the beginning of a page.
-   * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
-   * @return error code. 0 if no error
-   */
-  RC seek(PageId pid) const;
+  static long long getPageWriteCount();
 
  private:
   int     fd;     // file descriptor of the associated unix file
-  PageId  epid;   // (last page id + 1) of the file
-
-  //
-  // the following set of members implement LRU caching 
-  //
-  static const int CACHE_COUNT = 10;
-
-  static int cacheClock; // clock tick counter for LRU policy
-
-  // the actual cache data structure
-  static struct cacheStruct {
-    int    fd;              // file id of the cached page
-    PageId pid;             // page id of the cached page
-    int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
-
-  static int readCount;  // total # of page reads 
-  static int writeCount; // total # of page writes 
+  std::atomic<PageId> epid; // (last page id + 1) of the file
+  int     fid;    // id of the file in the buffer pool
+  bool    readOnly; // true if the file is opened in 'r' mode
+  int     pageSize; // the page size of the file
+  off_t   base;   // the file offset of page 0. the size of the header
+  char*   map;    // the memory mapping of the file. NULL if not mapped
+  size_t  mapSize;// the size of the mapping
+  IoStats* stats; // the statistics of the file
+
+  // the read-ahead state. the pages before raEnd have been prefetched.
+  mutable std::atomic<PageId> lastPid;  // the page pinned last
+  mutable std::atomic<int>    seqRun;   // # ascending pins in a row
+  mutable std::atomic<PageId> raEnd;    // the end of the prefetched pages
+  mutable std::atomic<int>    hint;     // the Access given to advise()
+  mutable std::atomic<int>    pending;  // # prefetch batches in flight
+
+  // read the header of an opened file, or write one to an empty file
+  RC readHeader(off_t size);
+
+  // prefetch the pages ahead of pid if the file is read sequentially
+  void readAhead(PageId pid) const;
+
+  // read n pages from first into the buffer pool in the background.
+  // returns the # of pages from first that are cached or being read
+  int prefetch(PageId first, int n) const;
+
+  // finish a prefetch batch. called on the I/O thread
+  struct Prefetch;
+  static void prefetched(void* arg, IoRequest* reqs, int n);
+
+  // copying would duplicate the mapping
+  PageFile(const PageFile&);
+  PageFile& operator=(const PageFile&);
+
+  static bool memoryMapped; // true to map files opened in 'r' mode
+  static int  defaultPageSize; // page size of the files created later
+  static int  readAheadPages;  // the read-ahead window in pages
 };
   
 #endif // PAGEFILE_H
@@ -9,7 +9,9 @@
 
 #include "Bruinbase.h"
 #include "RecordFile.h"
+#include <algorithm>
 #include <cstring>
+#include <vector>
 
 using std::string;
 
@@ -37,32 +39,6 @@ static void setRecordCount(char* page, int count);
 // helper functions for RecordId manipulation
 //
 
-// postfix record id iterator
-RecordId operator++ (RecordId& rid, int)
-{
-  RecordId prid(rid);
-
-  // if the end of a page is reached, move to the next page
-  if (++rid.sid >= RecordFile::RECORDS_PER_PAGE) {
-    rid.pid++;
-    rid.sid = 0;
-  }
-
-  return prid;
-}
-
-// prefix record id iterator
-RecordId& operator++ (RecordId& rid)
-{
-  // if the end of a page is reached, move to the next page
-  if (++rid.sid >= RecordFile::RECORDS_PER_PAGE) {
-    rid.pid++;
-    rid.sid = 0;
-  } 
-
-  return rid;
-}
-
 // RecordId comparators
 bool operator < (const RecordId& r1, const RecordId& r2)
 {
@@ -107,20 +83,29 @@ RecordFile::RecordFile()
 {
   erid.pid = 0;
   erid.sid = 0;
+  recordsPerPage = 0;
 }
 
 RecordFile::RecordFile(const string& filename, char mode)
 {
+  erid.pid = 0;
+  erid.sid = 0;
+  recordsPerPage = 0;
   open(filename, mode);
 }
 
 RC RecordFile::open(const string& filename, char mode)
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  char page[PageFile::MAX_PAGE_SIZE];
 
   // open the page file
   if ((rc = pf.open(filename, mode)) < 0) return rc;
+
+  // the number of slots follows from the page size of the file.
+  // note that we subtract sizeof(int) from the page size because the first
+  // four bytes in the page is used to store # records in the page.
+  recordsPerPage = (pf.getPageSize() - sizeof(int)) / (sizeof(int) + MAX_VALUE_LENGTH);
   
   //
   // in the rest of this function, we set the end record id
@@ -148,7 +133,7 @@ RC RecordFile::open(const string& filename, char mode)
 
   // get # records in the last page
   erid.sid = getRecordCount(page);
-  if (erid.sid >= RECORDS_PER_PAGE) {
+  if (erid.sid >= recordsPerPage) {
     // the last page is full. advance the end record id to the next page.
     erid.pid++;
     erid.sid = 0;
@@ -167,36 +152,70 @@ RC RecordFile::close()
 
 RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 {
-  RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  RC    rc;
+  char* page;
   
   // check whether the rid is in the valid range
   if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
-  if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
+  if (rid.sid < 0 || rid.sid >= recordsPerPage) return RC_INVALID_RID;
   if (rid >= erid) return RC_INVALID_RID;
   
-  // read the page containing the record
-  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  // pin the page containing the record. if every frame of the buffer
+  // pool is pinned, read a copy of the page instead.
+  if ((rc = pf.pin(rid.pid, page)) == RC_BUFFER_POOL_FULL) {
+    char copy[PageFile::MAX_PAGE_SIZE];
+    if ((rc = pf.read(rid.pid, copy)) < 0) return rc;
+    readSlot(copy, rid.sid, key, value);
+    return 0;
+  }
+  if (rc < 0) return rc;
 
   // read the record from the slot in the page
   readSlot(page, rid.sid, key, value);
 
+  return pf.unpin(rid.pid);
+}
+
+RC RecordFile::readBatch(const RecordId* rids, int n, int* keys, string* values) const
+{
+  RC rc;
+  std::vector<PageId> pids;
+
+  // check whether the rids are in the valid range
+  for (int i = 0; i < n; i++) {
+    if (rids[i].pid < 0 || rids[i].sid < 0) return RC_INVALID_RID;
+    if (rids[i].sid >= recordsPerPage) return RC_INVALID_RID;
+    if (rids[i] >= erid) return RC_INVALID_RID;
+    pids.push_back(rids[i].pid);
+  }
+
+  // load every page holding a record into the buffer pool at once
+  std::sort(pids.begin(), pids.end());
+  pids.erase(std::unique(pids.begin(), pids.end()), pids.end());
+  if ((rc = pf.readBatch(pids.data(), (int) pids.size(), NULL)) < 0) return rc;
+
+  // read the records in place from the pages in the pool
+  for (int i = 0; i < n; i++) {
+    if ((rc = read(rids[i], keys[i], values[i])) < 0) return rc;
+  }
+
   return 0;
 }
 
 RC RecordFile::append(int key, const std::string& value, RecordId& rid)
 {
-  RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  RC    rc;
+  char  empty[PageFile::MAX_PAGE_SIZE];
+  char* page = empty;
 
   // unless we are writing to the the first slot of an empty page,
-  // we have to read the page first
+  // we have to read the page first. we modify it in the buffer pool.
   if (erid.sid > 0) {
-    if ((rc = pf.read(erid.pid, page)) < 0) return rc;
+    if ((rc = pf.pin(erid.pid, page)) < 0) return rc;
   } else {
     // if this is the first slot of an empty page
     // we can simply initialize the page with zeros
-    memset(page, 0, PageFile::PAGE_SIZE);
+    memset(page, 0, pf.getPageSize());
   }
     
   // write the record to the first empty slot 
@@ -207,13 +226,15 @@ RC RecordFile::append(int key, const std::string& value, RecordId& rid)
   setRecordCount(page, erid.sid + 1);
 
   // write the page to the disk
-  if ((rc = pf.write(erid.pid, page)) < 0) return rc;
+  rc = pf.write(erid.pid, page);
+  if (page != empty) pf.unpin(erid.pid);
+  if (rc < 0) return rc;
     
   // we need to output the rid of the record slot
   rid = erid;
 
   // advance the end record id by one to the next empty slot
-  ++erid;
+  next(erid);
 
   return 0;
 }
@@ -223,6 +244,15 @@ const RecordId& RecordFile::endRid() const
   return erid;
 }
 
+void RecordFile::next(RecordId& rid) const
+{
+  // if the end of a page is reached, move to the next page
+  if (++rid.sid >= recordsPerPage) {
+    rid.pid++;
+    rid.sid = 0;
+  }
+}
+
 static int getRecordCount(const char* page)
 {
   int count;
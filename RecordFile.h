@@ -26,10 +26,6 @@ typedef struct {
 // helper functions for RecordId
 // 
 
-// RecordId iterators
-RecordId& operator++ (RecordId& rid);
-RecordId  operator++ (RecordId& rid, int);
-
 // RecordId comparators
 bool operator> (const RecordId& r1, const RecordId& r2);
 bool operator< (const RecordId& r1, const RecordId& r2);
@@ -47,11 +43,6 @@ class RecordFile {
   // maximum length of the value field
   static const int MAX_VALUE_LENGTH = 100;  
 
-  // number of record slots per page
-  static const int RECORDS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int))/ (sizeof(int) + MAX_VALUE_LENGTH);  
-    // Note that we subtract sizeof(int) from PAGE_SIZE because the first
-    // four bytes in the page is used to store # records in the page.
-
   RecordFile();
   RecordFile(const std::string& filename, char mode);
   
@@ -79,6 +70,18 @@ class RecordFile {
    */
   RC read(const RecordId& rid, int& key, std::string& value) const;
 
+  /**
+   * read many records at once. the pages holding the records are read
+   * with a single batch of concurrent reads, which pays off when the
+   * records are scattered over the file, e.g., after an index lookup.
+   * @param rids[IN] the ids of the records to read
+   * @param n[IN] the # of records to read
+   * @param keys[OUT] the record keys, one per record
+   * @param values[OUT] the record values, one per record
+   * @return error code. 0 if no error
+   */
+  RC readBatch(const RecordId* rids, int n, int* keys, std::string* values) const;
+
   /**
    * append a new record at the end of the file.
    * note that RecordFile does not have write() function.
@@ -96,9 +99,24 @@ class RecordFile {
    */
   const RecordId& endRid() const;
 
+  /**
+   * move a record id to the next record slot of the file.
+   * the slots of a page are followed by the first slot of the next page.
+   * @param rid[IN/OUT] the record id to move
+   */
+  void next(RecordId& rid) const;
+
+  /**
+   * tell the operating system how the file is going to be accessed.
+   * @param pattern[IN] the expected access pattern
+   * @return error code. 0 if no error
+   */
+  RC advise(PageFile::Access pattern) const { return pf.advise(pattern); }
+
  private:
   PageFile pf;     // the PageFile used to store the records
   RecordId erid;   // the last record id of the file + 1
+  int recordsPerPage; // number of record slots per page
 };
 
 #endif // RECORDFILE_H
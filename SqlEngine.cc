@@ -10,14 +10,22 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <climits>
+#include <ctime>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 #include "BTreeIndex.h"
+#include "IoStats.h"
+#include "KeySorter.h"
 
 using namespace std;
 
+// the # of index entries whose tuples are read at once by an index scan
+static const int FETCH_BATCH = 256;
+
 // external functions and variables for load file and sql command parsing 
 extern FILE* sqlin;
 int sqlparse(void);
@@ -35,16 +43,98 @@ RC SqlEngine::run(FILE* commandline)
   return 0;
 }
 
-RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
+// check whether a tuple meets every condition
+static bool meetsConds(const vector<SelCond>& cond, int key, const string& value)
+{
+  int diff;
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    // compute the difference between the tuple value and the condition value
+    switch (cond[i].attr) {
+    case 1:
+      // key - value could overflow
+      diff = (key > atoi(cond[i].value)) - (key < atoi(cond[i].value));
+      break;
+    case 2:
+      diff = strcmp(value.c_str(), cond[i].value);
+      break;
+    }
+
+    // skip the tuple if any condition is not met
+    switch (cond[i].comp) {
+    case SelCond::EQ:
+      if (diff != 0) return false;
+      break;
+    case SelCond::NE:
+      if (diff == 0) return false;
+      break;
+    case SelCond::GT:
+      if (diff <= 0) return false;
+      break;
+    case SelCond::LT:
+      if (diff >= 0) return false;
+      break;
+    case SelCond::GE:
+      if (diff < 0) return false;
+      break;
+    case SelCond::LE:
+      if (diff > 0) return false;
+      break;
+    }
+  }
+  return true;
+}
+
+// a tuple of a full scan, kept to be sorted by key
+typedef pair<int, string> SortedTuple;
+
+// order the tuples by ascending or descending key
+struct KeyBefore {
+  bool operator()(const SortedTuple& a, const SortedTuple& b) const { return a.first < b.first; }
+};
+
+struct KeyAfter {
+  bool operator()(const SortedTuple& a, const SortedTuple& b) const { return a.first > b.first; }
+};
+
+// print a tuple that met the conditions
+static void printTuple(int attr, int key, const string& value)
+{
+  switch (attr) {
+  case 1:  // SELECT key
+    fprintf(stdout, "%d\n", key);
+    break;
+  case 2:  // SELECT value
+    fprintf(stdout, "%s\n", value.c_str());
+    break;
+  case 3:  // SELECT *
+    fprintf(stdout, "%d '%s'\n", key, value.c_str());
+    break;
+  }
+}
+
+RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond,
+                     const SelOrder& order, SelStats* stats)
 {
   RecordFile rf;   // RecordFile containing the table
   RecordId   rid;  // record cursor for table scanning
+  SelPlan    plan; // how the tuples are found
+  BTreeIndex index;
+  IndexCursor cursor;
+  IndexScan  scan;
+  vector<SortedTuple> sorted;  // the tuples of a full scan to sort
+  int        keys[FETCH_BATCH];    // a batch of index entries and their tuples
+  RecordId   rids[FETCH_BATCH];
+  string     values[FETCH_BATCH];
+  bool       done;
 
   RC     rc;
   int    key;     
   string value;
-  int    count;
-  int    diff;
+  long long count;
+  long long limit;
+  long long scanned;
+  long long indexed;
 
   // open the table file
   if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
@@ -52,96 +142,375 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
     return rc;
   }
 
-  // scan the table file from the beginning
-  rid.pid = rid.sid = 0;
+  if ((rc = SqlEngine::plan(attr, table, cond, order, plan)) < 0) goto exit_select;
+
+  // an index that cannot be opened, e.g. of an older format, is skipped
+  if (plan.access != SelPlan::FULL_SCAN && index.open(table + ".idx", 'r') != 0) {
+    plan.access = SelPlan::FULL_SCAN;
+    plan.backward = false;
+    plan.sort = (order.dir != SelOrder::NONE && attr != 4);
+  }
+
   count = 0;
-  while (rid < rf.endRid()) {
-    // read the tuple
-    if ((rc = rf.read(rid, key, value)) < 0) {
-      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+  scanned = 0;
+  indexed = 0;
+
+  // the limit is on the tuples printed, and a count is a single row
+  limit = (order.limit < 0 || attr == 4) ? LLONG_MAX : order.limit;
+
+  if (plan.access == SelPlan::INDEX_COUNT) {
+    // the counts in the nonleaf nodes give the # of keys in the range
+    // without reading the entries
+    long long n;
+    if ((rc = index.countRange(plan.low, plan.high, n)) < 0) {
+      fprintf(stderr, "Error: while searching index %s.idx\n", table.c_str());
       goto exit_select;
     }
+    count = n;
+  } else if (plan.access != SelPlan::FULL_SCAN) {
+    // walk the leaves from the first key >= low up to high, or back from
+    // the last key <= high down to low, and read only the tuples of those
+    // keys. they are scattered over the table.
+    // an index-only plan reads no tuple, as the conditions and the
+    // result only need the key.
+    rf.advise(PageFile::RANDOM);
+    if (!plan.backward) {
+      rc = index.locate(plan.low, cursor);
+    } else if (plan.high == INT_MAX) {
+      // the end of the last leaf
+      cursor.pid = 0;
+      cursor.eid = 0;
+      rc = 0;
+    } else {
+      rc = index.locate(plan.high + 1, cursor);
+    }
+    if (rc < 0 && rc != RC_NO_SUCH_RECORD) {
+      fprintf(stderr, "Error: while searching index %s.idx\n", table.c_str());
+      goto exit_select;
+    }
+    if ((rc = scan.open(index, cursor)) < 0) {
+      fprintf(stderr, "Error: while reading index %s.idx\n", table.c_str());
+      goto exit_select;
+    }
+    done = false;
+    while (count < limit && !done) {
+      // take the entries in batches, forward the rest of the current leaf
+      // and backward one entry at a time. the batch is no larger than the
+      // # of tuples left to print, so a small limit reads few tuples.
+      int n = (limit - count < FETCH_BATCH) ? (int) (limit - count) : FETCH_BATCH;
+      if (!plan.backward) {
+        if ((rc = scan.read(keys, rids, n)) <= 0) break;
+        n = rc;
+      } else {
+        int m = 0;
+        while (m < n && (rc = scan.prev(keys[m], rids[m])) == 0) m++;
+        if (m == 0) break;
+        n = m;
+      }
 
-    // check the conditions on the tuple
-    for (unsigned i = 0; i < cond.size(); i++) {
-      // compute the difference between the tuple value and the condition value
-      switch (cond[i].attr) {
-      case 1:
-	diff = key - atoi(cond[i].value);
-	break;
-      case 2:
-	diff = strcmp(value.c_str(), cond[i].value);
-	break;
+      // drop the entries past the end of the range
+      for (int i = 0; i < n; i++) {
+        if (plan.backward ? keys[i] < plan.low : keys[i] > plan.high) {
+          n = i;
+          done = true;
+        }
+      }
+      indexed += n;
+
+      // read the tuples of the batch at once. their pages are scattered
+      // over the table, so the reads are issued together.
+      if (plan.access == SelPlan::INDEX_RANGE && n > 0) {
+        if ((rc = rf.readBatch(rids, n, keys, values)) < 0) {
+          fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+          goto exit_select;
+        }
+        scanned += n;
       }
 
-      // skip the tuple if any condition is not met
-      switch (cond[i].comp) {
-      case SelCond::EQ:
-	if (diff != 0) goto next_tuple;
-	break;
-      case SelCond::NE:
-	if (diff == 0) goto next_tuple;
-	break;
-      case SelCond::GT:
-	if (diff <= 0) goto next_tuple;
-	break;
-      case SelCond::LT:
-	if (diff >= 0) goto next_tuple;
-	break;
-      case SelCond::GE:
-	if (diff < 0) goto next_tuple;
-	break;
-      case SelCond::LE:
-	if (diff > 0) goto next_tuple;
-	break;
+      for (int i = 0; i < n && count < limit; i++) {
+        if (!meetsConds(cond, keys[i], values[i])) continue;
+        count++;
+        if (stats == NULL) printTuple(attr, keys[i], values[i]);
       }
+      if (rc < 0) break;
     }
+    if (rc < 0 && rc != RC_END_OF_TREE) {
+      fprintf(stderr, "Error: while reading index %s.idx\n", table.c_str());
+      goto exit_select;
+    }
+  } else {
+    // the table is read from the beginning to the end
+    rf.advise(PageFile::SEQUENTIAL);
+
+    // scan the table file from the beginning
+    rid.pid = rid.sid = 0;
+    while (rid < rf.endRid() && (plan.sort || count < limit)) {
+      // read the tuple
+      if ((rc = rf.read(rid, key, value)) < 0) {
+        fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+        goto exit_select;
+      }
+      scanned++;
+
+      // the condition is met for the tuple.
+      // increase matching tuple counter and print the tuple
+      if (meetsConds(cond, key, value)) {
+        if (plan.sort) {
+          sorted.push_back(SortedTuple(key, value));
+        } else {
+          count++;
+          if (stats == NULL) printTuple(attr, key, value);
+        }
+      }
 
-    // the condition is met for the tuple. 
-    // increase matching tuple counter
-    count++;
-
-    // print the tuple 
-    switch (attr) {
-    case 1:  // SELECT key
-      fprintf(stdout, "%d\n", key);
-      break;
-    case 2:  // SELECT value
-      fprintf(stdout, "%s\n", value.c_str());
-      break;
-    case 3:  // SELECT *
-      fprintf(stdout, "%d '%s'\n", key, value.c_str());
-      break;
+      // move to the next tuple
+      rf.next(rid);
     }
 
-    // move to the next tuple
-    next_tuple:
-    ++rid;
+    // the tuples in the order of their keys, in the order of the table
+    // among equal keys
+    if (plan.sort) {
+      if (order.dir == SelOrder::DESC) stable_sort(sorted.begin(), sorted.end(), KeyAfter());
+      else stable_sort(sorted.begin(), sorted.end(), KeyBefore());
+      for (unsigned i = 0; i < sorted.size() && count < limit; i++) {
+        count++;
+        if (stats == NULL) printTuple(attr, sorted[i].first, sorted[i].second);
+      }
+    }
   }
 
   // print matching tuple count if "select count(*)"
-  if (attr == 4) {
-    fprintf(stdout, "%d\n", count);
+  if (attr == 4 && stats == NULL && order.limit != 0) {
+    fprintf(stdout, "%lld\n", count);
+  }
+  if (stats != NULL) {
+    stats->access = plan.access;
+    stats->indexed = indexed;
+    stats->scanned = scanned;
+    stats->matched = count;
   }
   rc = 0;
 
   // close the table file and return
   exit_select:
+  scan.close();
+  if (plan.access != SelPlan::FULL_SCAN) index.close();
   rf.close();
   return rc;
 }
 
+RC SqlEngine::plan(int attr, const string& table, const vector<SelCond>& cond,
+                   const SelOrder& order, SelPlan& plan)
+{
+  BTreeIndex index;
+  RC         rc;
+
+  // an index that cannot be opened, e.g. of an older format, is not used,
+  // so that EXPLAIN shows the plan select() runs
+  plan.access = SelPlan::FULL_SCAN;
+  rc = index.open(table + ".idx", 'r');
+  plan.hasIndex = (rc == 0);
+  plan.oldIndex = (rc == RC_INVALID_FILE_FORMAT);
+  if (plan.hasIndex) index.close();
+  plan.keyRange = false;
+  plan.low = INT_MIN;
+  plan.high = INT_MAX;
+  plan.backward = false;
+  plan.sort = false;
+
+  // narrow down the key range with every condition on the key.
+  // a key may differ from a value in any number of places, so NE does
+  // not limit the range.
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr != 1 || cond[i].comp == SelCond::NE) continue;
+
+    int v = atoi(cond[i].value);
+    int low = INT_MIN, high = INT_MAX;
+    switch (cond[i].comp) {
+    case SelCond::EQ: low = high = v; break;
+    case SelCond::GE: low = v; break;
+    case SelCond::LE: high = v; break;
+    case SelCond::GT:
+      // no key is greater than INT_MAX, so the range becomes empty
+      if (v == INT_MAX) { low = INT_MAX; high = INT_MIN; }
+      else low = v + 1;
+      break;
+    case SelCond::LT:
+      if (v == INT_MIN) { low = INT_MAX; high = INT_MIN; }
+      else high = v - 1;
+      break;
+    default: break;
+    }
+    if (low > plan.low) plan.low = low;
+    if (high < plan.high) plan.high = high;
+    plan.keyRange = true;
+  }
+
+  if (plan.hasIndex && plan.keyRange) plan.access = SelPlan::INDEX_RANGE;
+
+  // the index holds every key, so SELECT key and COUNT(*) need no tuple
+  // unless a condition is on the value
+  if (plan.hasIndex && (attr == 1 || attr == 4)) {
+    bool keyOnly = true;
+    for (unsigned i = 0; i < cond.size(); i++) {
+      if (cond[i].attr != 1) keyOnly = false;
+    }
+    if (keyOnly) plan.access = SelPlan::INDEX_ONLY;
+  }
+
+  // COUNT(*) of a key range is answered from the counts in the index.
+  // NE leaves a hole in the range, so its entries are still read.
+  if (plan.access == SelPlan::INDEX_ONLY && attr == 4) {
+    bool range = true;
+    for (unsigned i = 0; i < cond.size(); i++) {
+      if (cond[i].comp == SelCond::NE) range = false;
+    }
+    if (range) plan.access = SelPlan::INDEX_COUNT;
+  }
+
+  // the index has the keys in order, so an ordered result is read from
+  // the index, backward for DESC, and only up to the limit. a count
+  // is a single row, which needs no order.
+  if (order.dir != SelOrder::NONE && attr != 4) {
+    if (plan.hasIndex && plan.access == SelPlan::FULL_SCAN) plan.access = SelPlan::INDEX_RANGE;
+    if (plan.access == SelPlan::FULL_SCAN) plan.sort = true;
+    else plan.backward = (order.dir == SelOrder::DESC);
+  }
+  return 0;
+}
+
+// the current time of a clock in microseconds
+static long long usecs(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// the counters of a file. all zero if the file has never been opened.
+static IoStats::Counters fileStats(const string& filename)
+{
+  IoStats* stats = IoStats::lookup(filename);
+  return (stats == NULL) ? IoStats::Counters() : stats->snapshot();
+}
+
+// print a step of a plan, with the # of tuples it produced if analyzed
+static void printStep(const string& step, bool analyze, long long rows)
+{
+  if (analyze) fprintf(stdout, "%-50s rows=%lld\n", step.c_str(), rows);
+  else fprintf(stdout, "%s\n", step.c_str());
+}
+
+RC SqlEngine::explain(int attr, const string& table, const vector<SelCond>& cond,
+                      const SelOrder& order, bool analyze)
+{
+  static const char* attrNames[] = { "", "key", "value", "*", "count(*)" };
+  static const char* compNames[] = { "=", "<>", "<", ">", "<=", ">=" };
+
+  RC       rc;
+  SelPlan  plan;
+  SelStats stats;
+  IoStats::Counters tbl, idx;
+  long long wall, cpu;
+
+  if ((rc = SqlEngine::plan(attr, table, cond, order, plan)) < 0) return rc;
+  stats.access = plan.access;
+  stats.indexed = stats.scanned = stats.matched = 0;
+  wall = cpu = 0;
+
+  // run the statement and measure the I/O of its files
+  if (analyze) {
+    tbl = fileStats(table + ".tbl");
+    idx = fileStats(table + ".idx");
+    wall = usecs(CLOCK_MONOTONIC);
+    cpu = usecs(CLOCK_PROCESS_CPUTIME_ID);
+    if ((rc = select(attr, table, cond, order, &stats)) < 0) return rc;
+    wall = usecs(CLOCK_MONOTONIC) - wall;
+    cpu = usecs(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    tbl = fileStats(table + ".tbl") - tbl;
+    idx = fileStats(table + ".idx") - idx;
+
+    // select() falls back to a scan if the index cannot be opened
+    if (plan.access != stats.access) {
+      plan.access = stats.access;
+      plan.backward = false;
+      plan.sort = (order.dir != SelOrder::NONE && attr != 4);
+    }
+  }
+
+  // the steps from the last one to the first one, each with the
+  // # of tuples it produced
+  if (attr == 4) printStep("Count", analyze, 1);
+  else printStep(string("Project: ") + attrNames[attr], analyze, stats.matched);
+
+  if (!cond.empty()) {
+    string filter = "  Filter:";
+    for (unsigned i = 0; i < cond.size(); i++) {
+      if (i > 0) filter += " AND";
+      filter += string(" ") + attrNames[cond[i].attr] + " " + compNames[cond[i].comp] + " ";
+      filter += (cond[i].attr == 2) ? "'" + string(cond[i].value) + "'" : string(cond[i].value);
+    }
+    printStep(filter, analyze, stats.matched);
+  }
+  if (plan.access == SelPlan::INDEX_COUNT) {
+    printStep("    Index Count: " + table + ".idx", analyze, stats.matched);
+  } else if (plan.access == SelPlan::INDEX_ONLY) {
+    printStep(string("    Index Only Scan") + (plan.backward ? " Backward" : "") + ": " +
+              table + ".idx", analyze, stats.indexed);
+  } else if (plan.access == SelPlan::INDEX_RANGE) {
+    printStep("    Fetch: " + table + ".tbl", analyze, stats.scanned);
+    printStep(string("      Index Range Scan") + (plan.backward ? " Backward" : "") + ": " +
+              table + ".idx", analyze, stats.indexed);
+  } else {
+    printStep("    Full Scan: " + table + ".tbl", analyze, stats.scanned);
+  }
+
+  // the key range the index would be searched with
+  if (!plan.keyRange) fprintf(stdout, "Key range: all keys\n");
+  else if (plan.low > plan.high) fprintf(stdout, "Key range: none\n");
+  else fprintf(stdout, "Key range: [%d, %d]\n", plan.low, plan.high);
+  if (order.dir != SelOrder::NONE && attr != 4) {
+    fprintf(stdout, "Order: key %s (%s)\n", (order.dir == SelOrder::DESC) ? "DESC" : "ASC",
+            plan.sort ? "sort" : "index");
+  }
+  if (order.limit >= 0) fprintf(stdout, "Limit: %d\n", order.limit);
+  if (plan.access != SelPlan::FULL_SCAN) fprintf(stdout, "Index: %s.idx\n", table.c_str());
+  else if (plan.hasIndex) fprintf(stdout, "Index: %s.idx (not used)\n", table.c_str());
+  else if (plan.oldIndex) fprintf(stdout, "Index: %s.idx (unsupported format, not used)\n", table.c_str());
+  else fprintf(stdout, "Index: none\n");
+
+  if (analyze) {
+    IoStats::printHeader(stdout, "");
+    IoStats::print(stdout, "", (table + ".tbl").c_str(), tbl);
+    if (plan.hasIndex) IoStats::print(stdout, "", (table + ".idx").c_str(), idx);
+    fprintf(stdout, "Time: %.3f ms wall, %.3f ms cpu\n", wall / 1000.0, cpu / 1000.0);
+  }
+
+  return 0;
+}
+
 RC SqlEngine::load(const string& table, const string& loadfile, bool index)
 {
   ifstream ifs;
   RecordId   rid;  // Cursor para buscar dentro de la tabla
   RecordFile rf;   // Contiene la tabla
   BTreeIndex bti;  // Indice para busqueda con indice
+  KeySorter  sorter;  // the index entries, sorted for bulkLoad()
+  RC         rc = 0;
 
   rf.open(table + ".tbl", 'w');
 
-  if (index) {
-    bti.open(table + ".idx", 'w');
+  // an index of an older format is not converted. it has to be removed
+  // and built again by loading the table
+  if (index && (rc = bti.open(table + ".idx", 'w')) != 0) {
+    if (rc == RC_INVALID_FILE_FORMAT) {
+      fprintf(stderr, "Error: index %s.idx has an unsupported format. remove it and load again\n",
+              table.c_str());
+    } else {
+      fprintf(stderr, "Error: cannot open index %s.idx\n", table.c_str());
+    }
+    rf.close();
+    return rc;
   }
 
   ifs.open(loadfile.c_str(), ifstream::in);
@@ -158,10 +527,9 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
       goto next_line;
     }
 
-    if (index) {
-      if (bti.insert(key, rid)) {
-        goto next_line;
-      }
+    if (index && (rc = sorter.add(key, rid)) != 0) {
+      fprintf(stderr, "Error: while building index %s.idx\n", table.c_str());
+      goto exit_load;
     }
     next_line:
     getline(ifs, line);
@@ -171,8 +539,28 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
   rf.close();
   ifs.close();
   if (index) {
+    // build the index from the entries in key order
+    if (rc == 0 && ((rc = sorter.sort()) != 0 || (rc = bti.bulkLoad(sorter)) != 0)) {
+      fprintf(stderr, "Error: while building index %s.idx\n", table.c_str());
+    }
     bti.close();
   }
+  return rc;
+}
+
+RC SqlEngine::showStats()
+{
+  vector<string>            names;
+  vector<IoStats::Counters> counters;
+
+  IoStats::snapshotAll(names, counters);
+  IoStats::printHeader(stdout, "");
+  for (unsigned i = 0; i < names.size(); i++) {
+    IoStats::print(stdout, "", names[i].c_str(), counters[i]);
+  }
+  IoStats::print(stdout, "", "total", IoStats::total());
+
+  return 0;
 }
 
 RC SqlEngine::parseLoadLine(const string& line, int& key, string& value)
@@ -23,6 +23,38 @@ struct SelCond {
   char* value;  // the value to compare
 };
 
+/**
+ * data structure to represent the ORDER BY and LIMIT clauses
+ */
+struct SelOrder {
+  enum Direction { NONE, ASC, DESC } dir;  // the order of the tuples by key
+  int limit;    // the most tuples to print. -1 for no limit
+};
+
+/**
+ * the way SqlEngine::select() executes a SELECT statement
+ */
+struct SelPlan {
+  enum Access { FULL_SCAN, INDEX_RANGE, INDEX_ONLY, INDEX_COUNT } access;  // how the tuples are found
+  bool hasIndex;  // true if the table has an index
+  bool oldIndex;  // true if the table has an index of a format that is not supported
+  bool keyRange;  // true if a condition on the key column limits the keys
+  int  low;       // the smallest key allowed by the key conditions
+  int  high;      // the largest key allowed by the key conditions
+  bool backward;  // true if the index is read from high to low
+  bool sort;      // true if the tuples of a full scan are sorted by key
+};
+
+/**
+ * the # of tuples that went through each step of a SELECT statement
+ */
+struct SelStats {
+  SelPlan::Access access;  // how the tuples were found
+  long long indexed;  // # index entries read, by an index range or index-only scan
+  long long scanned;  // # tuples read from the table
+  long long matched;  // # tuples that met all conditions, up to the limit
+};
+
 /**
  * the class that takes, parses, and executes the user commands.
  */
@@ -46,9 +78,49 @@ class SqlEngine {
    * (1: key, 2: value, 3: *, 4: count(*))
    * @param table[IN] the table name in the FROM clause
    * @param conds[IN] list of conditions in the WHERE clause
+   * @param order[IN] the ORDER BY and LIMIT clauses
+   * @param stats[OUT] if not NULL, the result is not printed and the
+   * # of tuples processed by each step is returned instead
+   * @return error code. 0 if no error
+   */
+  static RC select(int attr, const std::string& table, const std::vector<SelCond>& conds,
+                   const SelOrder& order, SelStats* stats = NULL);
+
+  /**
+   * choose how to execute a SELECT statement. the key conditions are
+   * combined into the range of keys [low, high] that can meet all of them.
+   * if the table has an index and the key conditions limit the keys,
+   * the index is searched for the range and only the tuples with a key
+   * in the range are read. if only the key or the count is selected and
+   * every condition is on the key, the statement is answered from the
+   * index alone without reading any tuple. otherwise, the whole table is
+   * scanned. the index gives the tuples in key order, so ORDER BY key
+   * reads the index, from the high end for DESC, and the scan stops at
+   * the limit. without an index, the tuples of the scan are sorted.
+   * @param attr[IN] attribute in the SELECT clause
+   * @param table[IN] the table name in the FROM clause
+   * @param conds[IN] list of conditions in the WHERE clause
+   * @param order[IN] the ORDER BY and LIMIT clauses
+   * @param plan[OUT] the plan select() follows for the statement
    * @return error code. 0 if no error
    */
-  static RC select(int attr, const std::string& table, const std::vector<SelCond>& conds);
+  static RC plan(int attr, const std::string& table, const std::vector<SelCond>& conds,
+                 const SelOrder& order, SelPlan& plan);
+
+  /**
+   * print the plan of a SELECT statement. with analyze, the statement is
+   * executed without printing its result, and the # of tuples of each
+   * step, the pages read from the table and the index, and the time
+   * spent are printed along with the plan.
+   * @param attr[IN] attribute in the SELECT clause
+   * @param table[IN] the table name in the FROM clause
+   * @param conds[IN] list of conditions in the WHERE clause
+   * @param order[IN] the ORDER BY and LIMIT clauses
+   * @param analyze[IN] true for EXPLAIN ANALYZE
+   * @return error code. 0 if no error
+   */
+  static RC explain(int attr, const std::string& table, const std::vector<SelCond>& conds,
+                    const SelOrder& order, bool analyze);
 
   /**
    * load a table from a load file.
@@ -59,6 +131,13 @@ class SqlEngine {
    */
   static RC load(const std::string& table, const std::string& loadfile, bool index);
 
+  /**
+   * print the I/O and cache statistics of every file opened so far,
+   * accumulated since the start of the process.
+   * @return error code. 0 if no error
+   */
+  static RC showStats();
+
   /**
    * parse a line from the load file into the (key, value) pair.
    * @param line[IN] a line from a load file
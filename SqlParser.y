@@ -4,28 +4,62 @@
 #include <sys/times.h>
 #include <unistd.h>
 #include <climits>
+#include <cstdlib>
 #include <string>
 #include "Bruinbase.h"
 #include "SqlEngine.h" 
 #include "PageFile.h"
+#include "IoStats.h"
 
 int  sqllex(void);  
 void sqlerror(const char *str) { fprintf(stderr, "Error: %s\n", str); }
 extern "C" { int  sqlwrap() { return 1; } }
 
-static void runSelect(int attr, const char* table, const std::vector<SelCond>& conds)
+static void runSelect(int attr, const char* table, const std::vector<SelCond>& conds,
+                      const SelOrder& order)
 {
   struct tms tmsbuf;
   clock_t btime, etime;
-  int     bpagecnt, epagecnt;
+  std::vector<std::string>        bnames, enames;
+  std::vector<IoStats::Counters>  bstats, estats;
+  IoStats::Counters total;
 
   btime = times(&tmsbuf);
-  bpagecnt = PageFile::getPageReadCount();
-  SqlEngine::select(attr, table, conds);
+  IoStats::snapshotAll(bnames, bstats);
+  SqlEngine::select(attr, table, conds, order);
   etime = times(&tmsbuf);
-  epagecnt = PageFile::getPageReadCount();
+  IoStats::snapshotAll(enames, estats);
+
+  fprintf(stderr, "  -- %.3f seconds to run the select command\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK));
+
+  // print the I/O of every file the select touched. the files opened
+  // for the first time are at the end of the list.
+  IoStats::printHeader(stderr, "  -- ");
+  for (unsigned i = 0; i < enames.size(); i++) {
+    IoStats::Counters c = (i < bstats.size()) ? estats[i] - bstats[i] : estats[i];
+    if (c.logicalReads == 0 && c.writes == 0 && c.prefetches == 0) continue;
+    IoStats::print(stderr, "  -- ", enames[i].c_str(), c);
+    total += c;
+  }
+  IoStats::print(stderr, "  -- ", "total", total);
+}
 
-  fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt);
+// the ORDER BY and LIMIT clauses of a statement
+static SelOrder makeOrder(int dir, int limit)
+{
+  SelOrder order;
+  order.dir = static_cast<SelOrder::Direction>(dir);
+  order.limit = limit;
+  return order;
+}
+
+// free the conditions of a WHERE clause
+static void freeConds(std::vector<SelCond>* conds)
+{
+  for (unsigned i = 0; i < conds->size(); i++) {
+    free((*conds)[i].value);
+  }
+  delete conds;
 }
 
 %}
@@ -37,15 +71,17 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
   std::vector<SelCond>* conds;
 }
 
-%token SELECT FROM WHERE LOAD WITH INDEX QUIT COUNT AND OR 
+%token SELECT FROM WHERE LOAD WITH INDEX QUIT COUNT AND OR SHOW STATS
+%token EXPLAIN ANALYZE
+%token ORDER BY ASC DESC LIMIT
 %token COMMA STAR LF
 %token <string> INTEGER STRING ID
 %token EQUAL NEQUAL LESS LESSEQUAL GREATER GREATEREQUAL 
 
-%type <integer> attributes attribute comparator
+%type <integer> attributes attribute comparator explain order direction limit
 %type <string> table value
 %type <cond> condition
-%type <conds> conditions
+%type <conds> conditions where
 %%
 
 commands:
@@ -56,6 +92,8 @@ commands:
 command:
         load_command { fprintf(stdout, "Bruinbase> "); }
 	| select_command { fprintf(stdout, "Bruinbase> "); }
+	| show_command { fprintf(stdout, "Bruinbase> "); }
+	| explain_command { fprintf(stdout, "Bruinbase> "); }
 	| quit_command
 	| error LF { fprintf(stdout, "Bruinbase> "); }
 	| LF { fprintf(stdout, "Bruinbase> "); }
@@ -65,6 +103,57 @@ quit_command:
 	QUIT { return 0; }
 	;
 
+show_command:
+	SHOW STATS LF { SqlEngine::showStats(); }
+	;
+
+explain_command:
+	explain SELECT attributes FROM table where order limit LF {
+		SqlEngine::explain($3, $5, *$6, makeOrder($7, $8), $1);
+		free($5);
+		freeConds($6);
+	}
+	;
+
+explain:
+	EXPLAIN { $$ = 0; }
+	| EXPLAIN ANALYZE { $$ = 1; }
+	;
+
+where:
+	{ $$ = new std::vector<SelCond>; }
+	| WHERE conditions { $$ = $2; }
+	;
+
+order:
+	{ $$ = SelOrder::NONE; }
+	| ORDER BY attribute direction {
+		if ($3 != 1) {
+			sqlerror("only ORDER BY key is supported");
+			YYERROR;
+		}
+		$$ = $4;
+	}
+	;
+
+direction:
+	{ $$ = SelOrder::ASC; }
+	| ASC { $$ = SelOrder::ASC; }
+	| DESC { $$ = SelOrder::DESC; }
+	;
+
+limit:
+	{ $$ = -1; }
+	| LIMIT INTEGER {
+		$$ = atoi($2);
+		free($2);
+		if ($$ < 0) {
+			sqlerror("LIMIT must not be negative");
+			YYERROR;
+		}
+	}
+	;
+
 load_command:
 	LOAD table FROM STRING LF { 
 	  SqlEngine::load(std::string($2), std::string($4), false); 
@@ -79,18 +168,10 @@ load_command:
 	;
 
 select_command:
-	SELECT attributes FROM table LF {
-   	        std::vector<SelCond> conds;
-		runSelect($2, $4, conds);
+	SELECT attributes FROM table where order limit LF {
+		runSelect($2, $4, *$5, makeOrder($6, $7));
 		free($4);
-	}
-	| SELECT attributes FROM table WHERE conditions LF {
-	        runSelect($2, $4, *$6);
-	  	free($4);
-	  	for (unsigned i = 0; i < $6->size(); i++) {
-		    free((*$6)[i].value);
-		}
-	  	delete $6;
+		freeConds($5);
 	}
 	;
 
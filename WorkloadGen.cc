@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+//
+// synthetic workload generator.
+// writes a load file in the format of movie.del and a matching script
+// of queries for the Bruinbase prompt, so that the behavior of the cache
+// and the index can be reproduced on tables of any size and skew.
+//
+// the load file holds the keys 1..rows in one of three orders:
+//
+//   seq     ascending
+//   random  a random permutation
+//   zipf    keys drawn from a Zipf distribution, so that hot keys repeat
+//
+// the queries are a mix of point lookups, range selects and range counts
+// on keys drawn uniformly or from a Zipf distribution. the hot keys of a
+// Zipf distribution are scattered over the key space rather than being
+// the smallest keys.
+//
+// the generator is deterministic for a given seed.
+//
+// usage: workload_gen [options]
+//   --rows N              # tuples in the load file (default 100000)
+//   --order seq|random|zipf   key order of the load file (default random)
+//   --value-length SPEC   fixed:N, uniform:MIN:MAX or normal:MEAN:STDDEV
+//                         (default uniform:8:40)
+//   --zipf-theta T        skew of the Zipf distributions, 0 < T < 1 (default 0.99)
+//   --table NAME          table name used in the queries (default workload)
+//   --queries N           # queries (default 10000)
+//   --query-keys uniform|zipf  distribution of the query keys (default zipf)
+//   --mix P,R,C           percent of point, range and count queries (default 80,15,5)
+//   --range-width W       # keys covered by a range query (default 100)
+//   --seed S              random seed (default 1)
+//   --load FILE           write the load file to FILE
+//   --script FILE         write the query script to FILE
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// the longest value a record can hold (RecordFile::MAX_VALUE_LENGTH)
+static const int MAX_VALUE_LENGTH = 100;
+
+static unsigned long long state = 1;
+
+// a random number generator that does not depend on the C library,
+// so that the output is the same everywhere
+static unsigned long long nextRandom()
+{
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+// a uniform random number in [0, 1)
+static double nextDouble()
+{
+  return (nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * draws ranks 0..n-1 with probability proportional to 1/(rank+1)^theta,
+ * using the method of Gray et al., "Quickly Generating Billion-Record
+ * Synthetic Databases", SIGMOD 1994.
+ */
+class Zipf {
+ public:
+  Zipf(long long n, double theta)
+  {
+    this->n = n;
+    this->theta = theta;
+    zetan = 0;
+    for (long long i = 1; i <= n; i++) zetan += 1.0 / pow((double) i, theta);
+    double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+    alpha = 1.0 / (1.0 - theta);
+    eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+  }
+
+  long long next()
+  {
+    double u = nextDouble();
+    double uz = u * zetan;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + pow(0.5, theta)) return 1;
+    long long rank = (long long) (n * pow(eta * u - eta + 1.0, alpha));
+    return (rank < n) ? rank : n - 1;
+  }
+
+ private:
+  long long n;
+  double    theta;
+  double    zetan;
+  double    alpha;
+  double    eta;
+};
+
+/**
+ * the length of a value
+ */
+struct LengthSpec {
+  enum { FIXED, UNIFORM, NORMAL } kind;
+  double a, b;   // the length, [min, max] or (mean, stddev)
+
+  int next() const
+  {
+    double length;
+    switch (kind) {
+    case FIXED:
+      length = a;
+      break;
+    case UNIFORM:
+      length = a + (long long) (nextRandom() % (unsigned long long) (b - a + 1));
+      break;
+    default:
+      // Box-Muller
+      length = a + b * sqrt(-2.0 * log(1.0 - nextDouble())) * cos(2 * M_PI * nextDouble());
+      break;
+    }
+    if (length < 1) length = 1;
+    if (length > MAX_VALUE_LENGTH - 1) length = MAX_VALUE_LENGTH - 1;
+    return (int) length;
+  }
+};
+
+static long long gcd(long long a, long long b)
+{
+  while (b != 0) { long long t = a % b; a = b; b = t; }
+  return a;
+}
+
+// map the ranks 0..n-1 of a Zipf distribution to the keys 1..n, so that
+// the hot keys are spread over the key space
+static long long step = 0;
+static long long scatter(long long rank, long long n)
+{
+  if (step == 0) {
+    step = 2654435761LL % n;
+    if (step == 0) step = 1;
+    while (gcd(step, n) != 1) step++;
+  }
+  return (rank * step) % n + 1;
+}
+
+static bool parseLength(const char* spec, LengthSpec& length)
+{
+  if (sscanf(spec, "fixed:%lf", &length.a) == 1) {
+    length.kind = LengthSpec::FIXED;
+    return length.a >= 1;
+  }
+  if (sscanf(spec, "uniform:%lf:%lf", &length.a, &length.b) == 2) {
+    length.kind = LengthSpec::UNIFORM;
+    return length.a >= 1 && length.a <= length.b;
+  }
+  if (sscanf(spec, "normal:%lf:%lf", &length.a, &length.b) == 2) {
+    length.kind = LengthSpec::NORMAL;
+    return length.b >= 0;
+  }
+  return false;
+}
+
+static void usage(const char* prog)
+{
+  fprintf(stderr,
+          "usage: %s [--rows N] [--order seq|random|zipf] [--value-length SPEC]\n"
+          "       [--zipf-theta T] [--table NAME] [--queries N] [--query-keys uniform|zipf]\n"
+          "       [--mix P,R,C] [--range-width W] [--seed S] [--load FILE] [--script FILE]\n"
+          "  SPEC is fixed:N, uniform:MIN:MAX or normal:MEAN:STDDEV\n", prog);
+}
+
+// write the load file
+static int writeLoad(const char* filename, long long rows, const std::string& order,
+                     const LengthSpec& length, double theta)
+{
+  static const char letters[] = "abcdefghijklmnopqrstuvwxyz     ";
+  FILE* f = fopen(filename, "w");
+  std::vector<int> keys;
+  Zipf* zipf = NULL;
+
+  if (f == NULL) {
+    fprintf(stderr, "Error: cannot write %s\n", filename);
+    return 1;
+  }
+
+  if (order == "random") {
+    // a Fisher-Yates shuffle of 1..rows
+    keys.resize(rows);
+    for (long long i = 0; i < rows; i++) keys[i] = (int) (i + 1);
+    for (long long i = rows - 1; i > 0; i--) {
+      long long j = (long long) (nextRandom() % (unsigned long long) (i + 1));
+      int t = keys[i]; keys[i] = keys[j]; keys[j] = t;
+    }
+  } else if (order == "zipf") {
+    zipf = new Zipf(rows, theta);
+  }
+
+  for (long long i = 0; i < rows; i++) {
+    long long key;
+    char value[MAX_VALUE_LENGTH];
+    int  n = length.next();
+
+    if (order == "seq") key = i + 1;
+    else if (order == "random") key = keys[i];
+    else key = scatter(zipf->next(), rows);
+
+    value[0] = 'A' + (int) (nextRandom() % 26);
+    for (int j = 1; j < n; j++) value[j] = letters[nextRandom() % (sizeof(letters) - 1)];
+    value[n] = 0;
+    fprintf(f, "%lld,\"%s\"\n", key, value);
+  }
+
+  delete zipf;
+  if (fclose(f) != 0) {
+    fprintf(stderr, "Error: cannot write %s\n", filename);
+    return 1;
+  }
+  return 0;
+}
+
+// write the query script
+static int writeScript(const char* filename, long long rows, const std::string& table,
+                       long long queries, const std::string& dist, const int* mix,
+                       long long width, double theta)
+{
+  FILE* f = fopen(filename, "w");
+  Zipf* zipf = (dist == "zipf") ? new Zipf(rows, theta) : NULL;
+
+  if (f == NULL) {
+    fprintf(stderr, "Error: cannot write %s\n", filename);
+    return 1;
+  }
+
+  for (long long q = 0; q < queries; q++) {
+    long long key = zipf ? scatter(zipf->next(), rows)
+                         : (long long) (nextRandom() % (unsigned long long) rows) + 1;
+    int kind = (int) (nextRandom() % 100);
+
+    if (kind < mix[0]) {
+      fprintf(f, "select * from %s where key = %lld\n", table.c_str(), key);
+    } else if (kind < mix[0] + mix[1]) {
+      fprintf(f, "select * from %s where key >= %lld and key < %lld\n",
+              table.c_str(), key, key + width);
+    } else {
+      fprintf(f, "select count(*) from %s where key >= %lld and key < %lld\n",
+              table.c_str(), key, key + width);
+    }
+  }
+
+  delete zipf;
+  if (fclose(f) != 0) {
+    fprintf(stderr, "Error: cannot write %s\n", filename);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  long long   rows = 100000;
+  std::string order = "random";
+  LengthSpec  length = { LengthSpec::UNIFORM, 8, 40 };
+  double      theta = 0.99;
+  std::string table = "workload";
+  long long   queries = 10000;
+  std::string dist = "zipf";
+  int         mix[3] = { 80, 15, 5 };
+  long long   width = 100;
+  const char* load = NULL;
+  const char* script = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    const char* val = (i + 1 < argc) ? argv[i + 1] : NULL;
+    bool ok = (val != NULL);
+
+    if (ok && strcmp(arg, "--rows") == 0) ok = (rows = atoll(val)) > 0;
+    else if (ok && strcmp(arg, "--order") == 0) {
+      order = val;
+      ok = (order == "seq" || order == "random" || order == "zipf");
+    }
+    else if (ok && strcmp(arg, "--value-length") == 0) ok = parseLength(val, length);
+    else if (ok && strcmp(arg, "--zipf-theta") == 0) ok = (theta = atof(val)) > 0 && theta < 1;
+    else if (ok && strcmp(arg, "--table") == 0) table = val;
+    else if (ok && strcmp(arg, "--queries") == 0) ok = (queries = atoll(val)) >= 0;
+    else if (ok && strcmp(arg, "--query-keys") == 0) {
+      dist = val;
+      ok = (dist == "uniform" || dist == "zipf");
+    }
+    else if (ok && strcmp(arg, "--mix") == 0) {
+      ok = sscanf(val, "%d,%d,%d", &mix[0], &mix[1], &mix[2]) == 3 &&
+           mix[0] >= 0 && mix[1] >= 0 && mix[2] >= 0 && mix[0] + mix[1] + mix[2] == 100;
+    }
+    else if (ok && strcmp(arg, "--range-width") == 0) ok = (width = atoll(val)) > 0;
+    else if (ok && strcmp(arg, "--seed") == 0) state = strtoull(val, NULL, 10) * 2685821657736338717ULL + 1;
+    else if (ok && strcmp(arg, "--load") == 0) load = val;
+    else if (ok && strcmp(arg, "--script") == 0) script = val;
+    else ok = false;
+
+    if (!ok) {
+      usage(argv[0]);
+      return 1;
+    }
+    i++;
+  }
+
+  if (load == NULL && script == NULL) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (load != NULL && writeLoad(load, rows, order, length, theta) != 0) return 1;
+  if (script != NULL && writeScript(script, rows, table, queries, dist, mix, width, theta) != 0) return 1;
+  return 0;
+}
@@ -9,10 +9,50 @@
  
 #include "Bruinbase.h"
 #include "SqlEngine.h"
+#include "BufferPool.h"
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
-int main()
+static void usage(const char* prog)
 {
+  fprintf(stderr, "usage: %s [--buffer-pool-mb N] [--write-back] [--mmap] [--page-size N]\n"
+          "       [--replacement lru|2q] [--read-ahead N]\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+  // parse the command line options
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--buffer-pool-mb") == 0 && i + 1 < argc) {
+      if (BufferPool::getInstance().setCapacity(atoi(argv[++i])) < 0) {
+        fprintf(stderr, "Error: invalid buffer pool size %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--write-back") == 0) {
+      BufferPool::getInstance().setWriteBack(true);
+    } else if (strcmp(argv[i], "--mmap") == 0) {
+      PageFile::setMemoryMapped(true);
+    } else if (strcmp(argv[i], "--replacement") == 0 && i + 1 < argc) {
+      BufferPool::Policy policy;
+      if (BufferPool::parsePolicy(argv[++i], policy) < 0) {
+        fprintf(stderr, "Error: invalid replacement policy %s\n", argv[i]);
+        return 1;
+      }
+      BufferPool::getInstance().setPolicy(policy);
+    } else if (strcmp(argv[i], "--read-ahead") == 0 && i + 1 < argc) {
+      PageFile::setReadAhead(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--page-size") == 0 && i + 1 < argc) {
+      if (PageFile::setDefaultPageSize(atoi(argv[++i])) < 0) {
+        fprintf(stderr, "Error: invalid page size %s\n", argv[i]);
+        return 1;
+      }
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
   // run the SQL engine taking user commands from standard input (console).
   SqlEngine::run(stdin);
 